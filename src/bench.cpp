@@ -0,0 +1,574 @@
+// Microbenchmarks for the solver, loader and picking hot paths. Each case is
+// timed over several samples and reported as ns/op, throughput and variance.
+// Results can be written as JSON for trend tracking across builds.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "structs/Camera.h"
+#include "structs/ClusteredLights.h"
+#include "structs/Hit.h"
+#include "structs/Mesh.h"
+#include "structs/Picking.h"
+#include "structs/RenderQueue.h"
+#include "structs/TetGenParser.h"
+#include "structs/TetGenerator.h"
+#include "structs/TextureCache.h"
+#include "structs/ThreadPool.h"
+#include <learnopengl/filesystem.h>
+
+struct BenchOptions {
+  int samples = 10;
+  double sample_ms = 20.0;
+  std::string filter;
+  std::string json_path;
+  // procedural meshes for size sweeps, e.g. "cube:8"
+  std::vector<std::string> generated;
+  std::string generate_dir = "/tmp";
+  std::vector<std::string> objects = {"pudding", "sphere", "bunny",
+                                      "tetrahedron"};
+};
+
+struct BenchResult {
+  std::string name;
+  double ns_per_op;
+  double stddev_ns;
+  double min_ns;
+  double items_per_op;
+  long iterations;
+  int samples;
+};
+
+// keeps results alive so the optimizer cannot drop the measured work
+volatile float bench_sink = 0.0f;
+
+class Bench {
+public:
+  std::vector<BenchResult> results;
+
+  explicit Bench(const BenchOptions &opt) : opt(opt) {}
+
+  // Times op() and reports it under name. setup() runs before every call
+  // but outside the measured time, for work that has to be undone between
+  // iterations (clearing containers, restoring particles).
+  void run(const std::string &name, double items_per_op,
+           const std::function<void()> &op,
+           const std::function<void()> &setup = nullptr) {
+    if (!opt.filter.empty() && name.find(opt.filter) == std::string::npos)
+      return;
+
+    // calibrate iterations so one sample takes roughly sample_ms
+    long iters = 1;
+    while (true) {
+      double ms = time(iters, op, setup) / 1e6;
+      if (ms >= opt.sample_ms || iters >= (1L << 30))
+        break;
+      long scale = ms <= 0.0 ? 10 : long(opt.sample_ms / ms * 1.2) + 1;
+      iters *= std::clamp(scale, 2L, 10L);
+    }
+
+    std::vector<double> ns_per_op;
+    for (int s = 0; s < opt.samples; s++)
+      ns_per_op.push_back(time(iters, op, setup) / iters);
+
+    double mean = 0;
+    for (double v : ns_per_op)
+      mean += v;
+    mean /= ns_per_op.size();
+    double var = 0;
+    for (double v : ns_per_op)
+      var += (v - mean) * (v - mean);
+    double stddev =
+        ns_per_op.size() > 1 ? std::sqrt(var / (ns_per_op.size() - 1)) : 0.0;
+    double min_ns = *std::min_element(ns_per_op.begin(), ns_per_op.end());
+
+    BenchResult r = {name,  mean,  stddev,     min_ns,
+                     items_per_op, iters, opt.samples};
+    results.push_back(r);
+    print(r);
+  }
+
+  bool write_json(const std::string &path) const {
+    std::ofstream file(path);
+    if (!file) {
+      std::cerr << "Cannot write " << path << std::endl;
+      return false;
+    }
+    file << "{\n  \"benchmarks\": [\n" << std::setprecision(10);
+    for (size_t i = 0; i < results.size(); i++) {
+      const BenchResult &r = results[i];
+      file << "    {\"name\": \"" << r.name << "\", \"ns_per_op\": "
+           << r.ns_per_op << ", \"stddev_ns\": " << r.stddev_ns
+           << ", \"min_ns\": " << r.min_ns
+           << ", \"items_per_op\": " << r.items_per_op
+           << ", \"items_per_second\": " << items_per_second(r)
+           << ", \"iterations\": " << r.iterations
+           << ", \"samples\": " << r.samples << "}"
+           << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return true;
+  }
+
+private:
+  const BenchOptions &opt;
+
+  double time(long iters, const std::function<void()> &op,
+              const std::function<void()> &setup) {
+    if (!setup) {
+      auto start = std::chrono::steady_clock::now();
+      for (long i = 0; i < iters; i++)
+        op();
+      return std::chrono::duration<double, std::nano>(
+                 std::chrono::steady_clock::now() - start)
+          .count();
+    }
+    double total = 0;
+    for (long i = 0; i < iters; i++) {
+      setup();
+      auto start = std::chrono::steady_clock::now();
+      op();
+      total += std::chrono::duration<double, std::nano>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    }
+    return total;
+  }
+
+  static double items_per_second(const BenchResult &r) {
+    return r.ns_per_op > 0 ? r.items_per_op * 1e9 / r.ns_per_op : 0.0;
+  }
+
+  static void print(const BenchResult &r) {
+    double cv = r.ns_per_op > 0 ? 100.0 * r.stddev_ns / r.ns_per_op : 0.0;
+    std::cout << std::left << std::setw(40) << r.name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(14)
+              << r.ns_per_op << " ns/op  +-" << std::setw(5) << cv << "%"
+              << std::setprecision(0) << std::setw(16) << items_per_second(r)
+              << " items/s" << std::endl;
+  }
+};
+
+// STL-style triangle soup built from the TetGen boundary faces, matching the
+// surface Assimp hands loadObject(). Empty when the asset has no .1.face.
+bool loadFaceSoup(const std::string &face_path,
+                  const vector<Particle> &particles, vector<Vertex> &vertices,
+                  vector<unsigned int> &indices) {
+  vector<glm::ivec3> faces;
+  if (!loadTetGenFaces(face_path, faces))
+    return false;
+  for (const glm::ivec3 &f : faces) {
+    for (int k = 0; k < 3; k++) {
+      if (f[k] < 0 || f[k] >= (int)particles.size())
+        return false;
+      Vertex v = {};
+      v.Position = particles[f[k]].pos;
+      indices.push_back(vertices.size());
+      vertices.push_back(v);
+    }
+  }
+  return !vertices.empty();
+}
+
+// Runs every case on <basePath>.node/.ele/.face, labelled with name.
+void benchObject(Bench &bench, const std::string &name,
+                 const std::string &basePath) {
+  std::string node_path = basePath + ".node";
+  std::string ele_path = basePath + ".ele";
+  const float mass = 0.1f;
+  const float dt = 1.0f / 60.0f / 3.0f;
+  const glm::vec3 gravity = {0, -10, 0};
+
+  Mesh base({}, {}, {}, true);
+  base.initSoftBody(node_path, ele_path, mass, 0.01f, 0.0f);
+  if (base.particles.empty()) {
+    std::cerr << "Skipping " << name << ": no particles" << std::endl;
+    return;
+  }
+  double n_particles = base.particles.size();
+  double n_tets = base.tetrahedrons.size();
+  double n_edges = base.edges.size();
+
+  // loader
+  bench.run("addParticlesTetGen/" + name, n_particles, [&] {
+    Mesh m({}, {}, {}, true);
+    m.addParticlesTetGen(node_path, mass);
+    bench_sink = bench_sink + m.particles.size();
+  });
+  Mesh loader = base;
+  bench.run(
+      "addTetraIDsTetGen/" + name, n_tets,
+      [&] {
+        loader.addTetraIDsTetGen(ele_path);
+        bench_sink = bench_sink + loader.tetrahedrons.size();
+      },
+      [&] { loader.tetrahedrons.clear(); });
+  ThreadPool pool;
+  bench.run(
+      "addTetraIDsTetGen/parallel/" + name, n_tets,
+      [&] {
+        loader.addTetraIDsTetGen(ele_path, &pool);
+        bench_sink = bench_sink + loader.tetrahedrons.size();
+      },
+      [&] { loader.tetrahedrons.clear(); });
+  bench.run(
+      "calcEdges/" + name, n_tets,
+      [&] {
+        loader.calcEdges();
+        bench_sink = bench_sink + loader.edges.size();
+      },
+      [&] { loader.edges.clear(); });
+
+  // solver, restarted from the rest pose so every sample does the same work
+  Mesh solver = base;
+  auto restore = [&] { solver.particles = base.particles; };
+  bench.run("pre_solve/" + name, n_particles,
+            [&] { solver.pre_solve(dt, gravity); }, restore);
+  bench.run("post_solve/" + name, n_particles,
+            [&] { solver.post_solve(dt); }, [&] {
+              restore();
+              solver.pre_solve(dt, gravity);
+            });
+  bench.run("solve_edges/" + name, n_edges,
+            [&] { solver.solve_edges(dt); }, [&] {
+              restore();
+              solver.pre_solve(dt, gravity);
+            });
+  bench.run("solve_volume/" + name, n_tets,
+            [&] { solver.solve_volume(dt); }, [&] {
+              restore();
+              solver.pre_solve(dt, gravity);
+            });
+
+  // surface mapping and picking need the render surface
+  vector<Vertex> vertices;
+  vector<unsigned int> indices;
+  if (!loadFaceSoup(basePath + ".face", base.particles,
+                    vertices, indices)) {
+    std::cout << "  (" << name
+              << ": no .face surface, skipping mapping and picking)"
+              << std::endl;
+    return;
+  }
+  Mesh surface(vertices, indices, {}, true);
+  surface.particles = base.particles;
+  bench.run(
+      "create_particle_vertex_map/" + name, n_particles + vertices.size(),
+      [&] {
+        surface.create_particle_vertex_map();
+        bench_sink = bench_sink + surface.vertex_particle.size();
+      });
+  // the same surface built straight from the .face ids, no welding
+  vector<glm::ivec3> faces;
+  loadTetGenFaces(basePath + ".face", faces);
+  Mesh faced = base;
+  bench.run("buildSurface/" + name, faces.size(), [&] {
+    faced.buildSurface(faces);
+    bench_sink = bench_sink + faced.indices.size();
+  });
+  // full recompute, then the incremental update after moving a tenth of
+  // the vertices
+  faced.buildSurface(faces); // in case the case above was filtered
+  bench.run("computeNormals/" + name, faces.size(), [&] {
+    faced.computeNormals();
+    bench_sink = bench_sink + faced.vertices[0].Normal.x;
+  });
+  faced.computeNormals();
+  size_t moved = std::max<size_t>(1, faced.vertices.size() / 10);
+  float nudge = 1e-3f;
+  bench.run("updateNormals/" + name + "/10%", moved, [&] {
+    nudge = -nudge;
+    for (size_t j = 0; j < moved; j++)
+      faced.vertices[j].Position.y += nudge;
+    faced.updateNormals();
+    bench_sink = bench_sink + faced.vertices[0].Normal.x;
+  });
+  surface.create_particle_vertex_map(); // in case the case above was filtered
+  bench.run("update_vertices/" + name, vertices.size(), [&] {
+    surface.update_vertices();
+    bench_sink = bench_sink + surface.vertices[0].Position.x;
+  });
+
+  // aim at the centre of the body from in front of it, like the default view
+  glm::vec3 centre = {0, 0, 0};
+  for (Particle &p : base.particles)
+    centre += p.pos;
+  centre /= n_particles;
+  Camera cam;
+  cam.Position = centre + glm::vec3(0, 0, 5.0f);
+  cam.Front = glm::normalize(centre - cam.Position);
+  Ray ray(cam.Position, cam.Front);
+  double n_triangles = indices.size() / 3;
+
+  bench.run("Mesh::intersect/" + name, n_triangles, [&] {
+    Hit h;
+    surface.intersect(ray, h, 0.0f);
+    bench_sink = bench_sink + h.getT();
+  });
+
+  Hit hit;
+  surface.intersect(ray, hit, 0.0f);
+  bench.run("findPointRT/" + name, n_particles, [&] {
+    Particle *p = findPointRT(cam, hit, surface);
+    bench_sink = bench_sink + p->pos.x;
+  });
+}
+
+// Texture decode with CPU mips, first without and then with the mip cache.
+void benchTexture(Bench &bench, const std::string &file) {
+  std::string path = FileSystem::getPath(file);
+  std::string name = std::filesystem::path(file).filename().string();
+  TextureImage probe = decodeTexture(path);
+  if (!probe.pixels) {
+    std::cerr << "Skipping " << file << ": cannot decode" << std::endl;
+    return;
+  }
+  double pixels = double(probe.width) * probe.height;
+  bench.run("decodeTexture/" + name, pixels, [&] {
+    bench_sink = bench_sink + decodeTexture(path).levels.size();
+  });
+
+  std::string dir = std::filesystem::temp_directory_path().string() +
+                    "/slimebench_mips";
+  MipCache::get().setDirectory(dir);
+  decodeTexture(path); // populate
+  bench.run("decodeTexture/mip-cache/" + name, pixels, [&] {
+    bench_sink = bench_sink + decodeTexture(path).levels.size();
+  });
+  MipCache::get().setDirectory("");
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+}
+
+// Render queue key sort with a scene-like key distribution: a few programs
+// and materials, many VAOs and depths. std::sort is the reference.
+void benchRenderSort(Bench &bench, int draws) {
+  std::vector<RenderItem> keys(draws), items, scratch;
+  uint32_t seed = 1;
+  for (int i = 0; i < draws; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    uint64_t program = seed % 3, material = (seed >> 8) % 40;
+    uint64_t vao = (seed >> 4) % 1000;
+    keys[i] = {program << 56 | material << 40 | vao << 24 |
+                   depthKey((seed >> 12) % 1000 * 0.1f),
+               uint32_t(i)};
+  }
+  std::string name = std::to_string(draws);
+  auto reset = [&] { items = keys; };
+  bench.run("radixSortRenderItems/" + name, draws, [&] {
+    radixSortRenderItems(items, scratch);
+    bench_sink = bench_sink + items[0].command;
+  }, reset);
+  bench.run("std::sort/" + name, draws, [&] {
+    std::sort(items.begin(), items.end(),
+              [](const RenderItem &a, const RenderItem &b) {
+                return a.key < b.key;
+              });
+    bench_sink = bench_sink + items[0].command;
+  }, reset);
+}
+
+// Frustum test of many bounding spheres scattered around the camera.
+void benchCulling(Bench &bench, int spheres) {
+  glm::mat4 view_projection =
+      glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f) *
+      glm::lookAt(glm::vec3(0.0f), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+  Frustum frustum = Frustum::fromViewProjection(view_projection);
+  std::vector<float> x(spheres), y(spheres), z(spheres), radius(spheres);
+  uint32_t seed = 1;
+  auto next = [&] {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / float(1 << 24);
+  };
+  for (int i = 0; i < spheres; i++) {
+    x[i] = next() * 100 - 50;
+    y[i] = next() * 100 - 50;
+    z[i] = next() * 100 - 50;
+    radius[i] = next() * 2;
+  }
+  std::vector<uint8_t> visible(spheres);
+  bench.run("cullSpheres/" + std::to_string(spheres), spheres, [&] {
+    cullSpheres(frustum, x.data(), y.data(), z.data(), radius.data(),
+                spheres, visible.data());
+    bench_sink = bench_sink + visible[0];
+  });
+}
+
+// Queue build for copies of one mesh: submit, cull, sort and batch, without
+// the GL half of execute(). Returns false if the copies did not end up in a
+// single instanced batch.
+bool benchInstancing(Bench &bench, int copies) {
+  vector<Vertex> corners(8);
+  for (int i = 0; i < 8; i++)
+    corners[i].Position = glm::vec3(i & 1, (i >> 1) & 1, i >> 2) - 0.5f;
+  Mesh cube(corners,
+            {0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+             2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3},
+            {}, true);
+  cube.computeBounds();
+  cube.VAO = 1; // never drawn; batching only needs it to be non-zero
+  Shader shader;
+  // a square grid the camera sees whole, so nothing is culled
+  int side = std::ceil(std::sqrt(float(copies)));
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 1.5f * side + 1.0f),
+                               glm::vec3(0), glm::vec3(0, 1, 0));
+  std::vector<glm::mat4> models;
+  for (int i = 0; i < copies; i++)
+    models.push_back(glm::translate(
+        glm::mat4(1.0f),
+        glm::vec3(i % side - side / 2, i / side - side / 2, 0.0f)));
+
+  RenderQueue queue;
+  GLStateCache state;
+  auto build = [&] {
+    queue.setCamera(projection, view);
+    for (const glm::mat4 &model : models)
+      queue.submit(shader, cube, queue.addTransform(model));
+    queue.prepare(state);
+  };
+  build();
+  size_t batches = queue.batchCount();
+  queue.clear();
+  uint64_t culled = state.takeStats().culled;
+  if (batches != 1 || culled != 0) {
+    std::cerr << "ERROR::BENCH::INSTANCING " << copies << " copies made "
+              << batches << " batches, " << culled << " culled" << std::endl;
+    return false;
+  }
+  bench.run("RenderQueue::prepare/instanced/" + std::to_string(copies),
+            copies, [&] {
+              build();
+              bench_sink = bench_sink + queue.batchCount();
+              queue.clear();
+            });
+  return true;
+}
+
+// Clustered light binning of small lights spread through the view.
+void benchLightBinning(Bench &bench, int count) {
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+  glm::mat4 view =
+      glm::lookAt(glm::vec3(0, 2, 10), glm::vec3(0), glm::vec3(0, 1, 0));
+  std::vector<PointLight> lights(count);
+  uint32_t seed = 1;
+  auto next = [&] {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / float(1 << 24);
+  };
+  for (PointLight &light : lights) {
+    light.position = {next() * 20 - 10, next() * 4 - 2, next() * 20 - 10};
+    light.diffuse = glm::vec3(0.5f);
+    light.linear = 2.0f;
+    light.quadratic = 20.0f;
+    light.radius = attenuationRadius(light);
+  }
+  ClusteredLights clusters;
+  bench.run("ClusteredLights::bin/" + std::to_string(count), count, [&] {
+    clusters.bin(lights, view, projection, 0.1f, 100.0f, 800, 600);
+    bench_sink = bench_sink + clusters.lightReferences();
+  });
+}
+
+void print_usage() {
+  std::cout << "usage: slimeBench [options]\n"
+            << "  --filter <text>      only run benchmarks whose name "
+               "contains text\n"
+            << "  --objects <a,b,..>   assets to use (default "
+               "pudding,sphere,bunny,tetrahedron)\n"
+            << "  --generate <s:n,..>  also run on generated meshes, e.g. "
+               "cube:8,cube:16,sphere:32\n"
+            << "  --generate-dir <d>   where generated meshes are written "
+               "(default /tmp)\n"
+            << "  --samples <n>        samples per benchmark (default 10)\n"
+            << "  --sample-ms <ms>     target duration of one sample "
+               "(default 20)\n"
+            << "  --json <file>        write results as JSON\n";
+}
+
+int main(int argc, char *argv[]) {
+  BenchOptions opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      print_usage();
+      return 1;
+    }
+    if (arg == "--filter") {
+      opt.filter = argv[++i];
+    } else if (arg == "--samples") {
+      opt.samples = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--sample-ms") {
+      opt.sample_ms = std::stod(argv[++i]);
+    } else if (arg == "--json") {
+      opt.json_path = argv[++i];
+    } else if (arg == "--generate") {
+      std::stringstream list(argv[++i]);
+      std::string spec;
+      while (std::getline(list, spec, ','))
+        opt.generated.push_back(spec);
+    } else if (arg == "--generate-dir") {
+      opt.generate_dir = argv[++i];
+    } else if (arg == "--objects") {
+      opt.objects.clear();
+      std::stringstream list(argv[++i]);
+      std::string object;
+      while (std::getline(list, object, ','))
+        opt.objects.push_back(object);
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+
+  Bench bench(opt);
+  for (const std::string &object : opt.objects)
+    benchObject(bench, object,
+                FileSystem::getPath("assets/" + object + "/" + object + ".1"));
+
+  for (const std::string &spec : opt.generated) {
+    size_t colon = spec.find(':');
+    TetShape shape;
+    if (colon == std::string::npos ||
+        !parseTetShape(spec.substr(0, colon), shape)) {
+      std::cerr << "Bad --generate entry " << spec << std::endl;
+      return 1;
+    }
+    int resolution = std::stoi(spec.substr(colon + 1));
+    std::string name = spec.substr(0, colon) + std::to_string(resolution);
+    std::string base = opt.generate_dir + "/slimebench_" + name;
+    if (!writeTetGenFiles(generateTetMesh(shape, resolution), base))
+      return 1;
+    benchObject(bench, name, base);
+  }
+
+  for (const char *file :
+       {"assets/backpack/ao.jpg", "assets/floor/texture_wood.png"})
+    benchTexture(bench, file);
+
+  for (int draws : {4096, 65536})
+    benchRenderSort(bench, draws);
+  benchCulling(bench, 4096);
+  for (int copies : {16, 4096})
+    if (!benchInstancing(bench, copies))
+      return 1;
+  for (int lights : {64, 512})
+    benchLightBinning(bench, lights);
+
+  if (!opt.json_path.empty() && !bench.write_json(opt.json_path))
+    return 1;
+  return 0;
+}
@@ -13,10 +13,15 @@
 #include <glm/geometric.hpp>
 #include <glm/trigonometric.hpp>
 #include <iostream>
+#include <iterator>
 #include <stdio.h>
 
+#include "structs/AssetLoader.h"
+#include "structs/AssetPack.h"
 #include "structs/Camera.h"
+#include "structs/ClusteredLights.h"
 #include "structs/Shader.h"
+#include "structs/UniformBlocks.h"
 #include "structs/stb_image.h"
 
 #include "structs/debugging.h"
@@ -25,6 +30,12 @@
 #include "structs/Ray.h"
 
 #include "structs/Model.h"
+#include "structs/PerfOverlay.h"
+#include "structs/Picking.h"
+#include "structs/Profiler.h"
+#include "structs/RenderQueue.h"
+#include "structs/Replay.h"
+#include "structs/SoftBodyCache.h"
 #include <learnopengl/filesystem.h>
 
 #include <glm/glm.hpp>
@@ -33,12 +44,19 @@
 
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+const float Z_NEAR = 0.1f;
+const float Z_FAR = 100.0f;
+int framebuffer_width = SCR_WIDTH;
+int framebuffer_height = SCR_HEIGHT;
 
 glm::vec3 gravity = {0, -10, 0};
 int substeps = 3;
 
 float mixValue = 0.2;
 
+// main thread time per frame spent uploading streamed assets
+const double UPLOAD_BUDGET_MS = 2.0;
+
 glm::mat4 view;
 
 float deltaTime = 0.0f; // Time between current frame and last frame
@@ -62,9 +80,20 @@ Hit *h = new Hit();
 
 bool cursor = false;
 
+InputRecorder recorder;
+InputReplayer replayer;
+PerfOverlay perf;
+RenderQueue render_queue;
+GLStateCache gl_state;
+ClusteredLights clustered_lights;
+// small coloured lights scattered over the floor, to load the light culling
+int extra_lights = 0;
+
 // Create callback function for resizing window
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
   glViewport(0, 0, width, height);
+  framebuffer_width = width;
+  framebuffer_height = height;
 }
 
 void mouse_callback(GLFWwindow *window, double xposIn, double yposIn) {
@@ -149,49 +178,86 @@ void processInput(GLFWwindow *window) {
   }
 }
 
-Model loadObject(const std::string &name) {
+// Starts loading the soft body on a loader thread. The tet setup (or the
+// cache load) runs there too. The surface comes from the TetGen .face file
+// when there is one, otherwise the .stl is imported and welded to the
+// particles. The tet setup is split across pool, which must outlive the
+// load.
+ModelHandle loadObject(AssetLoader &loader, const std::string &name,
+                       ThreadPool *pool) {
   std::string basePath = "assets/" + name + "/" + name;
 
-  Model testModel(FileSystem::getPath(basePath + ".stl"));
-
-  testModel.meshes[0].initSoftBody(FileSystem::getPath(basePath + ".1.node"),
-                                   FileSystem::getPath(basePath + ".1.ele"),
-                                   mass, edge_compliance, volume_compliance);
-  return testModel;
-}
-
-Mesh *intersection(Camera &c, Model &m, Hit &h) {
-  Mesh *hitMesh = nullptr;
-  bool intersect = false;
-  Ray r(c.Position, c.Front);
-  for (Mesh &mesh : m.meshes) {
-    // buffer var to check when to update mesh
-    float t0 = h.getT();
-    mesh.intersect(r, h, 0.0f);
-    float t1 = h.getT();
-    // update hitMesh if t is updated
-    if (t1 < t0) {
-      hitMesh = &mesh;
-      intersect = true;
+  std::string stl = FileSystem::getPath(basePath + ".stl");
+  std::string node = FileSystem::getPath(basePath + ".1.node");
+  std::string ele = FileSystem::getPath(basePath + ".1.ele");
+  std::string face = FileSystem::getPath(basePath + ".1.face");
+  std::string cache = FileSystem::getPath(basePath + ".1.slsb");
+  float ec = edge_compliance, vc = volume_compliance;
+
+  return loader.buildModel(name, [=]() -> std::unique_ptr<Model> {
+    vector<glm::ivec3> faces;
+    bool has_faces = loadTetGenFaces(face, faces);
+    std::unique_ptr<Model> model;
+    Mesh body({}, {}, {}, true);
+    if (!has_faces) {
+      model = std::make_unique<Model>(stl, false, true);
+      if (model->meshes.empty())
+        return model;
+      body = std::move(model->meshes[0]);
     }
-  }
-  return hitMesh;
+    // the welded mapping depends on the .stl, so it is part of the cache
+    // key. A .face surface is rebuilt after the load instead.
+    std::vector<std::string> sources = {node, ele};
+    if (!has_faces)
+      sources.push_back(stl);
+    if (!loadSoftBodyCache(body, cache, sources, mass, ec, vc)) {
+      body.initSoftBody(node, ele, mass, ec, vc, pool);
+      if (!writeSoftBodyCache(body, cache, sources, mass))
+        std::cerr << "ERROR::SOFTBODY_CACHE::CANNOT_WRITE " << cache
+                  << std::endl;
+    }
+    if (!has_faces) {
+      model->meshes[0] = std::move(body);
+      return model;
+    }
+    body.buildSurface(faces);
+    std::vector<Mesh> meshes;
+    meshes.push_back(std::move(body));
+    return std::make_unique<Model>(std::move(meshes), true);
+  });
 }
 
-Particle *findPointRT(Camera &c, Hit &h, Mesh &hitMesh) {
-  float t = h.getT();
-  glm::vec3 intersection_point = c.Position + t * c.Front;
-  Particle *nearest_particle = &hitMesh.particles[0];
-  float min_distance = glm::length(intersection_point - nearest_particle->pos);
-
-  for (Particle &p : hitMesh.particles) {
-    float new_distance = glm::length(intersection_point - p.pos);
-    if (new_distance < min_distance) {
-      nearest_particle = &p;
-      min_distance = new_distance;
-    }
+// The lamp above the scene followed by count extra lights on a grid over
+// the floor.
+std::vector<PointLight> scene_lights(int count) {
+  std::vector<PointLight> lights;
+  PointLight lamp;
+  lamp.position = {0.0f, 5.0f, 0.0f};
+  lamp.ambient = {0.3f, 0.3f, 0.3f};
+  lamp.diffuse = {0.7f, 0.7f, 0.7f};
+  lamp.specular = {1.0f, 1.0f, 1.0f};
+  lamp.constant = 1.0f;
+  lamp.linear = 0.09f;
+  lamp.quadratic = 0.032f;
+  lamp.radius = attenuationRadius(lamp);
+  lights.push_back(lamp);
+
+  int side = std::ceil(std::sqrt(float(count)));
+  for (int i = 0; i < count; i++) {
+    PointLight light;
+    float u = (i % side + 0.5f) / side, v = (i / side + 0.5f) / side;
+    light.position = {20.0f * u - 10.0f, -1.5f, 20.0f * v - 10.0f};
+    light.diffuse = 0.5f * glm::vec3(0.5f + 0.5f * std::sin(7.0f * i),
+                                     0.5f + 0.5f * std::sin(7.0f * i + 2.1f),
+                                     0.5f + 0.5f * std::sin(7.0f * i + 4.2f));
+    light.specular = light.diffuse;
+    light.constant = 1.0f;
+    light.linear = 2.0f;
+    light.quadratic = 20.0f;
+    light.radius = attenuationRadius(light);
+    lights.push_back(light);
   }
-  return nearest_particle;
+  return lights;
 }
 
 void reset_grabbed() {
@@ -294,19 +360,20 @@ int main(int argc, char *argv[]) {
                         (void *)(3 * sizeof(float)));
   glEnableVertexAttribArray(1);
 
-  stbi_set_flip_vertically_on_load(true);
+  setTextureFlipVertically(true);
+  MipCache::get().setDirectory(FileSystem::getPath(".cache/mips"));
 
   Shader ourShader(FileSystem::getPath("src/shaders/texture2.vert").c_str(),
                    FileSystem::getPath("src/shaders/texture2.frag").c_str());
   ourShader.use();
 
-  ourShader.setVec3("pointLights[0].position", 0.0f, 5.0f, 0.0f);
-  ourShader.setVec3("pointLights[0].ambient", 0.1f, 0.1f, 0.1f);
-  ourShader.setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-  ourShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-  ourShader.setFloat("pointLights[0].constant", 1.0f);
-  ourShader.setFloat("pointLights[0].linear", 0.09f);
-  ourShader.setFloat("pointLights[0].quadratic", 0.032f);
+  // camera and lights are shared by every program through uniform buffers
+  UniformBuffer<CameraBlock> camera_ubo;
+  UniformBuffer<LightsBlock> lights_ubo;
+  camera_ubo.create(CAMERA_BLOCK_BINDING);
+  lights_ubo.create(LIGHTS_BLOCK_BINDING);
+  LightsBlock lights = {};
+  std::vector<PointLight> point_lights = scene_lights(extra_lights);
 
   ourCam.Position = {0, 1, 5.0f};
 
@@ -314,9 +381,26 @@ int main(int argc, char *argv[]) {
                                                "tetrahedron"};
 
   int object_index = 0; // change this to change object used
-
-  if (argc > 1) {
-    object_index = std::stoi(argv[1]); // take from cmd
+  std::string record_path;
+  std::string replay_path;
+  std::string trace_path = "slime_trace.json";
+  std::string pack_path;
+  bool tracing = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--record" && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      trace_path = argv[++i];
+      tracing = true;
+    } else if (arg == "--pack" && i + 1 < argc) {
+      pack_path = argv[++i];
+    } else {
+      object_index = std::stoi(arg); // take from cmd
+    }
   }
 
   if (object_index < 0 || object_index >= availableObjects.size()) {
@@ -324,10 +408,37 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  Model testModel = loadObject(availableObjects[object_index]);
+  // opened explicitly so a stale pack never shadows edited loose assets
+  if (!pack_path.empty() &&
+      !AssetPack::get().open(pack_path, FileSystem::getPath(""))) {
+    return 1;
+  }
+
+  std::string object_name = availableObjects[object_index];
+  if (!replay_path.empty()) {
+    if (!replayer.open(replay_path)) {
+      return 1;
+    }
+    object_name = replayer.object_name;
+  }
+  if (!record_path.empty() && !recorder.open(record_path, object_name)) {
+    return 1;
+  }
 
-  Model floor(
+  Profiler::get().setThreadName("main");
+  Profiler::get().enabled = tracing;
+
+  // splits the soft body setup and its per-frame normal update. Declared
+  // before the loader so it outlives the loads using it.
+  ThreadPool frame_pool;
+  AssetLoader loader;
+  ModelHandle body_asset = loadObject(loader, object_name, &frame_pool);
+  ModelHandle floor_asset = loader.loadModel(
       FileSystem::getPath("assets/chessboarddfloor/chesssboardfloor.obj"));
+  // one model drawn at every cubePositions entry, so the render queue
+  // batches the copies into a single instanced draw
+  ModelHandle cube_asset =
+      loader.loadModel(FileSystem::getPath("assets/cube/cube.obj"));
 
   // Initialize ImGUI
   IMGUI_CHECKVERSION();
@@ -341,68 +452,121 @@ int main(int argc, char *argv[]) {
   glEnable(GL_BLEND); // you enable blending function
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+  // the simulation needs the body from the first frame, the floor streams in
+  if (!loader.finish(body_asset)) {
+    std::cout << "Failed to load " << object_name << std::endl;
+    return 1;
+  }
+  Model &testModel = *body_asset->model;
+
   // Render loop
   while (!glfwWindowShouldClose(window)) {
+    PROFILE_ZONE("frame");
     float currentFrame = glfwGetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
+
+    loader.pumpUploads(UPLOAD_BUDGET_MS);
+
     // Inputs
-    processInput(window);
+    FrameInput frame_input;
+    {
+      PROFILE_ZONE("input");
+      if (replayer.is_open()) {
+        if (!replayer.next(frame_input)) {
+          std::cout << "Replay finished after " << replayer.frames << " frames"
+                    << std::endl;
+          break;
+        }
+        if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+          glfwSetWindowShouldClose(window, true);
+        deltaTime = frame_input.dt;
+        ourCam.Position = frame_input.cam_pos;
+        ourCam.Front = frame_input.cam_front;
+      } else {
+        processInput(window);
+      }
+    }
+
     // Rendering Commands
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Tell OpenGL a new frame is about to begin
-    ImGui_ImplOpenGL3_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
-
-    ImGui::SetNextWindowPos(ImVec2(0, 0), ImGuiCond_Always);
-    // ImGUI window creation
-    ImGui::Begin("Soft Body Parameters", nullptr,
-                 ImGuiWindowFlags_AlwaysAutoResize);
-    // Sliders for parameters
-    ImGui::SliderFloat("Edge compliance", &testModel.meshes[0].edge_compliance,
-                       0.01f, 0.2f);
-    ImGui::SliderFloat("Volume compliance",
-                       &testModel.meshes[0].volume_compliance, 0.0f, 0.2f);
-    ImGui::SliderInt("Substeps", &substeps, 1, 50);
-
-    if (ImGui::Button("Reset")) {
-      reset = true;
-    }
-    if (ImGui::Button("Lift")) {
-      // Optional: do something on click
-    }
+    bool lift = false;
+    {
+      PROFILE_ZONE("ImGui build");
+      // Tell OpenGL a new frame is about to begin
+      ImGui_ImplOpenGL3_NewFrame();
+      ImGui_ImplGlfw_NewFrame();
+      ImGui::NewFrame();
+
+      ImGui::SetNextWindowPos(ImVec2(0, 0), ImGuiCond_Always);
+      // ImGUI window creation
+      ImGui::Begin("Soft Body Parameters", nullptr,
+                   ImGuiWindowFlags_AlwaysAutoResize);
+      // Sliders for parameters
+      ImGui::SliderFloat("Edge compliance",
+                         &testModel.meshes[0].edge_compliance, 0.01f, 0.2f);
+      ImGui::SliderFloat("Volume compliance",
+                         &testModel.meshes[0].volume_compliance, 0.0f, 0.2f);
+      ImGui::SliderInt("Substeps", &substeps, 1, MAX_SUBSTEPS);
+      if (ImGui::SliderInt("Extra lights", &extra_lights, 0, 1024))
+        point_lights = scene_lights(extra_lights);
+      ImGui::Text("lights in view %zu, cluster references %zu",
+                  clustered_lights.lightsInView(),
+                  clustered_lights.lightReferences());
+
+      if (ImGui::Button("Reset")) {
+        reset = true;
+      }
+      if (ImGui::Checkbox("Record trace", &tracing)) {
+        Profiler::get().enabled = tracing;
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Save trace")) {
+        Profiler::get().writeChromeTrace(trace_path);
+      }
+      ImGui::Checkbox("Performance", &perf.visible);
+      if (ImGui::Button("Lift")) {
+        // Optional: do something on click
+      }
 
-    // Detect if "Lift" button is being held down
-    if (ImGui::IsItemActive()) {
-      for (int i = 0; i < testModel.meshes[0].particles.size(); ++i) {
-        testModel.meshes[0].particles[i].pos += glm::vec3(0, 0.01f, 0);
+      // Detect if "Lift" button is being held down
+      lift = ImGui::IsItemActive();
+
+      if (replayer.is_open()) {
+        testModel.meshes[0].edge_compliance = frame_input.edge_compliance;
+        testModel.meshes[0].volume_compliance = frame_input.volume_compliance;
+        substeps = frame_input.substeps;
+        lift = frame_input.lift;
       }
-    }
 
-    // Ends the window
-    ImGui::End();
+      if (lift) {
+        for (int i = 0; i < testModel.meshes[0].particles.size(); ++i) {
+          testModel.meshes[0].particles[i].pos += glm::vec3(0, 0.01f, 0);
+        }
+      }
 
-    ourShader.use();
+      // Ends the window
+      ImGui::End();
 
-    ourShader.setVec3("pointLights[0].position", 0.0f, 5.0f, 0.0f);
-    ourShader.setVec3("pointLights[0].ambient", 0.3f, 0.3f, 0.3f);
-    ourShader.setVec3("pointLights[0].diffuse", 0.7f, 0.7f, 0.7f);
-    ourShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-    ourShader.setFloat("pointLights[0].constant", 1.0f);
-    ourShader.setFloat("pointLights[0].linear", 0.09f);
-    ourShader.setFloat("pointLights[0].quadratic", 0.032f);
+      perf.endFrame(deltaTime, gl_state.takeStats());
+      perf.draw();
+    }
+
+    ourShader.use();
 
     glm::mat4 projection = glm::mat4(1.0f);
     projection =
         glm::perspective(glm::radians(ourCam.Zoom),
-                         (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-
-    ourShader.setMat4("projection", projection);
+                         (float)SCR_WIDTH / (float)SCR_HEIGHT, Z_NEAR, Z_FAR);
     view = ourCam.GetViewMatrix();
-    ourShader.setMat4("view", view);
+    camera_ubo.update({projection, view, ourCam.Position});
+    clustered_lights.bin(point_lights, view, projection, Z_NEAR, Z_FAR,
+                         framebuffer_width, framebuffer_height);
+    clustered_lights.upload();
+    lights.clusters = clustered_lights.block();
+    lights_ubo.update(lights);
 
     glm::mat4 model = glm::mat4(1.0f);
     model = glm::translate(
@@ -414,13 +578,33 @@ int main(int argc, char *argv[]) {
         model,
         glm::vec3(1.0f, 1.0f,
                   1.0f)); // it's a bit too big for our scene, so scale it down
-    ourShader.setMat4("model", model);
 
-    testModel.Draw(ourShader);
-    glm::mat4 floor_model = glm::translate(model, glm::vec3(0.0f, -2.0f, 0.0f));
-    ourShader.setMat4("model", floor_model);
-    floor.Draw(ourShader);
-    testModel.meshes[0].update(deltaTime, substeps, gravity);
+    {
+      PROFILE_PHASE("Model::Draw", PHASE_DRAW);
+      render_queue.setCamera(projection, view);
+      testModel.Submit(render_queue, ourShader, model);
+      glm::mat4 floor_model =
+          glm::translate(model, glm::vec3(0.0f, -2.0f, 0.0f));
+      if (floor_asset->ready())
+        floor_asset->model->Submit(render_queue, ourShader, floor_model);
+      if (cube_asset->ready()) {
+        for (size_t i = 0; i < std::size(cubePositions); i++) {
+          glm::mat4 cube_model = glm::translate(
+              model, cubePositions[i] + glm::vec3(0.0f, 0.0f, -3.0f));
+          cube_model = glm::rotate(cube_model, glm::radians(20.0f * i),
+                                   glm::vec3(1.0f, 0.3f, 0.5f));
+          cube_model = glm::scale(cube_model, glm::vec3(0.25f));
+          cube_asset->model->Submit(render_queue, ourShader, cube_model);
+        }
+      }
+      render_queue.execute(gl_state);
+    }
+    testModel.meshes[0].update(deltaTime, substeps, gravity, &frame_pool);
+
+    if (replayer.is_open()) {
+      reset = frame_input.reset;
+    }
+    frame_input.reset = reset;
 
     if (reset) {
       testModel.meshes[0].reset();
@@ -428,11 +612,30 @@ int main(int argc, char *argv[]) {
       reset = false;
     }
 
+    if (replayer.is_open()) {
+      grab = frame_input.grab;
+    }
+
     if (grab) {
       if (grabbed_particle == nullptr) {
-        Mesh *hitMesh = intersection(ourCam, testModel, *h);
-        if (hitMesh != nullptr) {
-          grabbed_particle = findPointRT(ourCam, *h, *hitMesh);
+        if (replayer.is_open()) {
+          // picking was resolved when the session was recorded
+          if (frame_input.pick_particle >= 0 &&
+              frame_input.pick_particle <
+                  (int)testModel.meshes[0].particles.size()) {
+            grabbed_particle =
+                &testModel.meshes[0].particles[frame_input.pick_particle];
+            h->set(frame_input.pick_t);
+          }
+        } else {
+          PROFILE_PHASE("intersection", PHASE_PICKING);
+          Mesh *hitMesh = intersection(ourCam, testModel.meshes, *h);
+          if (hitMesh != nullptr) {
+            grabbed_particle = findPointRT(ourCam, *h, *hitMesh);
+            frame_input.pick_particle =
+                grabbed_particle - &hitMesh->particles[0];
+            frame_input.pick_t = h->getT();
+          }
         }
       } else {
         grabbed_particle->inv_mass = 0.0f;
@@ -445,13 +648,46 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    if (recorder.is_open()) {
+      frame_input.dt = deltaTime;
+      frame_input.grab = grab;
+      frame_input.lift = lift;
+      frame_input.cam_pos = ourCam.Position;
+      frame_input.cam_front = ourCam.Front;
+      frame_input.edge_compliance = testModel.meshes[0].edge_compliance;
+      frame_input.volume_compliance = testModel.meshes[0].volume_compliance;
+      frame_input.substeps = substeps;
+      recorder.record(frame_input);
+    }
+
+    {
+      PROFILE_ZONE("ImGui render");
+      ImGui::Render();
+      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
 
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+    {
+      PROFILE_ZONE("swap");
+      glfwSwapBuffers(window);
+      glfwPollEvents();
+    }
   }
 
+  recorder.close();
+  if (tracing) {
+    Profiler::get().writeChromeTrace(trace_path);
+  }
+
+  testModel.releaseTextures();
+  if (floor_asset->ready())
+    floor_asset->model->releaseTextures();
+  if (cube_asset->ready())
+    cube_asset->model->releaseTextures();
+  render_queue.release();
+  clustered_lights.release();
+  camera_ubo.release();
+  lights_ubo.release();
+
   // Deletes all ImGUI instances
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
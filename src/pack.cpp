@@ -0,0 +1,137 @@
+// Asset packer: bundles the assets directory into a single file that the
+// engine and slimeSim map at startup with --pack, see AssetPack.h.
+
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "structs/AssetPack.h"
+#include <learnopengl/filesystem.h>
+
+struct PackOptions {
+  std::string root;
+  std::string out_path;
+  std::string list_path;
+  std::vector<std::string> inputs;
+};
+
+void print_usage() {
+  std::cout
+      << "usage: slimePack [options] [paths...]\n"
+      << "  paths                files or directories relative to the root "
+         "(default assets)\n"
+      << "  --root <dir>         directory the pack names are relative to "
+         "(default the project root)\n"
+      << "  --out <file>         pack to write (default <root>/assets.pack)\n"
+      << "  --list <file>        print the contents of a pack and exit\n";
+}
+
+bool parse_options(int argc, char *argv[], PackOptions &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      return false;
+    } else if (arg.rfind("--", 0) != 0) {
+      opt.inputs.push_back(arg);
+    } else if (!has_value) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    } else if (arg == "--root") {
+      opt.root = argv[++i];
+    } else if (arg == "--out") {
+      opt.out_path = argv[++i];
+    } else if (arg == "--list") {
+      opt.list_path = argv[++i];
+    } else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Build products and caches that must not end up in a pack.
+bool skipFile(const std::filesystem::path &path) {
+  std::string ext = path.extension().string();
+  if (ext == ".slsb" || ext == ".tmp" || ext == ".mips" || ext == ".pack")
+    return true;
+  for (const auto &part : path)
+    if (part == ".cache" || part == ".git")
+      return true;
+  return false;
+}
+
+int listPack(const std::string &path) {
+  AssetPack &pack = AssetPack::get();
+  if (!pack.open(path, "."))
+    return 1;
+  std::vector<std::pair<std::string_view, std::string_view>> entries(
+      pack.contents().begin(), pack.contents().end());
+  // file order, which is the sorted name order
+  std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+    return a.second.data() < b.second.data();
+  });
+  const char *base = entries.empty() ? nullptr : entries[0].second.data();
+  size_t total = 0;
+  for (const auto &[name, blob] : entries) {
+    std::cout << std::setw(12) << blob.size() << "  " << std::setw(12)
+              << (blob.data() - base) << "  " << name << "\n";
+    total += blob.size();
+  }
+  std::cout << entries.size() << " files, " << total << " bytes" << std::endl;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  PackOptions opt;
+  if (!parse_options(argc, argv, opt)) {
+    print_usage();
+    return 1;
+  }
+  if (!opt.list_path.empty())
+    return listPack(opt.list_path);
+
+  if (opt.root.empty())
+    opt.root = FileSystem::getPath("");
+  if (opt.out_path.empty())
+    opt.out_path = (std::filesystem::path(opt.root) / "assets.pack").string();
+  if (opt.inputs.empty())
+    opt.inputs = {"assets"};
+
+  namespace fs = std::filesystem;
+  std::vector<std::string> names;
+  for (const std::string &input : opt.inputs) {
+    fs::path dir = fs::path(opt.root) / input;
+    std::error_code ec;
+    if (fs::is_regular_file(dir, ec)) {
+      names.push_back(fs::path(input).lexically_normal().generic_string());
+      continue;
+    }
+    if (!fs::is_directory(dir, ec)) {
+      std::cerr << "ERROR::ASSET_PACK::FILE_NOT_FOUND " << input << std::endl;
+      return 1;
+    }
+    for (const auto &entry : fs::recursive_directory_iterator(dir, ec)) {
+      if (!entry.is_regular_file())
+        continue;
+      fs::path rel = entry.path().lexically_relative(opt.root);
+      if (!skipFile(rel))
+        names.push_back(rel.generic_string());
+    }
+  }
+  // sorted so packs are reproducible and related files sit next to each other
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+
+  if (!writeAssetPack(opt.root, names, opt.out_path))
+    return 1;
+  std::error_code ec;
+  std::cout << "slimePack: " << names.size() << " files, "
+            << fs::file_size(opt.out_path, ec) << " bytes -> " << opt.out_path
+            << std::endl;
+  return 0;
+}
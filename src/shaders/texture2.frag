@@ -7,7 +7,12 @@ in vec3 FragPos;
   
 uniform vec3 objectColor;
 uniform vec3 lightColor;
-uniform vec3 viewPos;
+
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
 
 
 uniform sampler2D emission;
@@ -28,18 +33,6 @@ struct DirLight {
     vec3 specular;
 };
 
-struct PointLight {
-    vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
 struct SpotLight {
     vec3 position;
     vec3 direction;
@@ -50,59 +43,102 @@ struct SpotLight {
     vec3 specular;
 };
 
+// Point lights are binned into view space clusters on the CPU, see
+// ClusteredLights.h. clusterGrid holds the tiles on x and y, the depth
+// slices and the light count; clusterScale the tiles per pixel on x and y
+// and the scale and bias that turn log(depth) into a slice.
+layout (std140) uniform Lights {
+    DirLight dirlight;
+    SpotLight spotlight;
+    uvec4 clusterGrid;
+    vec4 clusterScale;
+};
 
-#define nr_of_pt_lights 4
-uniform PointLight pointLights[nr_of_pt_lights];
+// four texels per light: position and radius, ambient and constant,
+// diffuse and linear, specular and quadratic
+uniform samplerBuffer lightData;
+// per cluster: offset into lightIndices and light count
+uniform usamplerBuffer lightGrid;
+uniform usamplerBuffer lightIndices;
 
-uniform DirLight dirlight;
-uniform SpotLight spotlight;
 uniform Material material;
 
-vec3 calcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+// material colors, sampled once per fragment
+struct Surface {
+    vec3 albedo;
+    vec3 specular;
+};
+
+vec3 calcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir);
+vec3 calcPointLight(int light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 calcSpotLight(SpotLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir);
+int clusterIndex(vec3 fragPos);
 
 void main()
 {
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
+    Surface surface;
+    surface.albedo = vec3(texture(material.diffuse, TexCoords));
+    surface.specular = vec3(texture(material.specular, TexCoords));
 
     vec3 result = vec3(0.0);
-    result += calcDirLight(dirlight, norm, viewDir);
-    for (int i = 0; i < nr_of_pt_lights; i++) {
-        result += calcPointLight(pointLights[i], norm, FragPos, viewDir);
+    result += calcDirLight(dirlight, surface, norm, viewDir);
+    uvec2 lights = texelFetch(lightGrid, clusterIndex(FragPos)).xy;
+    for (uint i = 0u; i < lights.y; i++) {
+        int light = int(texelFetch(lightIndices, int(lights.x + i)).r);
+        result += calcPointLight(light, surface, norm, FragPos, viewDir);
     }
-    result += calcSpotLight(spotlight, norm, FragPos, viewDir);
+    result += calcSpotLight(spotlight, surface, norm, FragPos, viewDir);
     FragColor = vec4(result, 1.0);
 }
 
-vec3 calcDirLight(DirLight light, vec3 normal, vec3 viewDir) {
+// Must match ClusteredLights::bin().
+int clusterIndex(vec3 fragPos) {
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * clusterScale.xy), clusterGrid.xy - 1u);
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    int slice = int(floor(log(depth) * clusterScale.z + clusterScale.w));
+    uint z = uint(clamp(slice, 0, int(clusterGrid.z) - 1));
+    return int(tile.x + clusterGrid.x * (tile.y + clusterGrid.y * z));
+}
+
+vec3 calcDirLight(DirLight light, Surface surface, vec3 normal, vec3 viewDir) {
     vec3 lightDir = normalize(light.direction);
     float diff = max(dot(normal, lightDir), 0.0);
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * surface.albedo;
+    vec3 diffuse = light.diffuse * diff * surface.albedo;
+    vec3 specular = light.specular * spec * surface.specular;
     return (ambient + diffuse + specular);
 }
 
-vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
-    vec3 lightDir = normalize(light.position - fragPos);
-    float diff = max(dot(normal, lightDir), 0.0); 
+vec3 calcPointLight(int light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir) {
+    vec4 position = texelFetch(lightData, 4 * light);
+    vec4 ambientConstant = texelFetch(lightData, 4 * light + 1);
+    vec4 diffuseLinear = texelFetch(lightData, 4 * light + 2);
+    vec4 specularQuadratic = texelFetch(lightData, 4 * light + 3);
+
+    // the clusters are coarser than the light; cut it off at its radius so
+    // cluster edges do not show
+    float distance = length(position.xyz - fragPos);
+    if (distance > position.w)
+        return vec3(0.0);
+    vec3 lightDir = normalize(position.xyz - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / light.constant + light.linear * distance + light.quadratic * distance * distance;
-    
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-    return (ambient + diffuse + specular);
+    float attenuation = 1.0 / (ambientConstant.w + diffuseLinear.w * distance +
+                               specularQuadratic.w * distance * distance);
+
+    vec3 ambient = ambientConstant.rgb * surface.albedo;
+    vec3 diffuse = diffuseLinear.rgb * diff * surface.albedo;
+    vec3 specular = specularQuadratic.rgb * spec * surface.specular;
+    return (ambient + diffuse + specular) * attenuation;
 }
 
-vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
+vec3 calcSpotLight(SpotLight light, Surface surface, vec3 normal, vec3 fragPos, vec3 viewDir) {
     vec3 lightDir = normalize(light.position - fragPos);
     float theta = dot(lightDir, normalize(-light.direction));
     vec3 color = vec3(0.0);
@@ -111,14 +147,14 @@ vec3 calcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
         float diff = max(dot(normal, lightDir), 0.0);
         vec3 reflectDir = reflect(-lightDir, normal);
         float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-        
-        vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-        vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-        vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+
+        vec3 ambient = light.ambient * surface.albedo;
+        vec3 diffuse = light.diffuse * diff * surface.albedo;
+        vec3 specular = light.specular * spec * surface.specular;
 
         color = color + ambient + diffuse + specular;
     } else {
-        color = light.ambient * vec3(texture(material.diffuse, TexCoords));
+        color = light.ambient * surface.albedo;
     }
     return color;
 }
@@ -8,8 +8,16 @@ layout (location = 5) in vec4 aBoneID;
 layout (location = 6) in vec4 aWeights;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-instance model matrix of instanced draws, used instead of model when
+// instanced is set (see RenderQueue.h)
+layout (location = 7) in mat4 instanceModel;
+uniform bool instanced;
+
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
 
 out vec3 Normal;
 out vec3 FragPos;
@@ -17,8 +25,9 @@ out vec2 TexCoords;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal; 
+    mat4 world = instanced ? instanceModel : model;
+    gl_Position = projection * view * world * vec4(aPos, 1.0);
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(world))) * aNormal;
     TexCoords = aTexCoords;
 } 
@@ -0,0 +1,360 @@
+// Headless soft body runner: loads TetGen assets and steps the XPBD solver
+// without a window or GL context. Used for batch simulations and benchmarks.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "structs/AssetPack.h"
+#include "structs/Mesh.h"
+#include "structs/Profiler.h"
+#include "structs/Replay.h"
+#include "structs/SoftBodyCache.h"
+#include "structs/TetGenerator.h"
+#include "structs/ThreadPool.h"
+#include <learnopengl/filesystem.h>
+
+struct SimOptions {
+  std::string object = "bunny";
+  std::string generate;
+  int resolution = 16;
+  std::string export_base;
+  int frames = 600;
+  bool frames_set = false;
+  int substeps = 3;
+  int bodies = 1;
+  unsigned int threads = 1;
+  float dt = 1.0f / 60.0f;
+  bool recorded_dt = false;
+  bool use_cache = true;
+  float mass = 0.1f;
+  float edge_compliance = 0.01f;
+  float volume_compliance = 0.0f;
+  std::string replay_path;
+  std::string out_path;
+  std::string timings_path;
+  std::string trace_path;
+  std::string pack_path;
+};
+
+void print_usage() {
+  std::cout
+      << "usage: slimeSim [options]\n"
+      << "  --object <name>      asset under assets/<name>/<name>.1.node/.ele "
+         "(default bunny)\n"
+      << "  --generate <shape>   use a procedural cube, sphere or beam "
+         "instead of an asset\n"
+      << "  --resolution <n>     cells per side of the generated mesh "
+         "(default 16)\n"
+      << "  --export <base>      write the generated mesh to "
+         "<base>.node/.ele/.face\n"
+      << "  --frames <n>         frames to simulate (default 600)\n"
+      << "  --substeps <n>       solver substeps per frame (default 3)\n"
+      << "  --bodies <n>         independent copies of the object (default "
+         "1)\n"
+      << "  --threads <n>        worker threads, bodies are split across "
+         "them (default 1)\n"
+      << "  --dt <seconds>       fixed frame timestep (default 1/60)\n"
+      << "  --replay <file>      drive body 0 from a recorded session\n"
+      << "  --recorded-dt        use the timesteps stored in the replay\n"
+      << "  --no-cache           always parse the asset, skip the .slsb cache\n"
+      << "  --pack <file>        read assets from a pack built by slimePack\n"
+      << "  --out <file>         write final particle positions as a TetGen "
+         ".node file\n"
+      << "  --timings <file>     write per-frame timings as CSV\n"
+      << "  --trace <file>       record a Chrome trace of the run\n";
+}
+
+bool parse_options(int argc, char *argv[], SimOptions &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--help" || arg == "-h") {
+      return false;
+    } else if (arg == "--recorded-dt") {
+      opt.recorded_dt = true;
+    } else if (arg == "--no-cache") {
+      opt.use_cache = false;
+    } else if (!has_value) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    } else if (arg == "--object") {
+      opt.object = argv[++i];
+    } else if (arg == "--generate") {
+      opt.generate = argv[++i];
+    } else if (arg == "--resolution") {
+      opt.resolution = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--export") {
+      opt.export_base = argv[++i];
+    } else if (arg == "--frames") {
+      opt.frames = std::stoi(argv[++i]);
+      opt.frames_set = true;
+    } else if (arg == "--substeps") {
+      opt.substeps = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--bodies") {
+      opt.bodies = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--threads") {
+      opt.threads = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--dt") {
+      opt.dt = std::stof(argv[++i]);
+    } else if (arg == "--replay") {
+      opt.replay_path = argv[++i];
+    } else if (arg == "--out") {
+      opt.out_path = argv[++i];
+    } else if (arg == "--timings") {
+      opt.timings_path = argv[++i];
+    } else if (arg == "--trace") {
+      opt.trace_path = argv[++i];
+    } else if (arg == "--pack") {
+      opt.pack_path = argv[++i];
+    } else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+Mesh loadSoftBody(const SimOptions &opt, const std::string &name,
+                  ThreadPool &pool) {
+  std::string basePath = "assets/" + name + "/" + name;
+  std::string node = FileSystem::getPath(basePath + ".1.node");
+  std::string ele = FileSystem::getPath(basePath + ".1.ele");
+  Mesh body({}, {}, {}, true);
+  // headless bodies have no surface, so they get their own cache file
+  std::string cache = FileSystem::getPath(basePath + ".1.headless.slsb");
+  if (opt.use_cache && loadSoftBodyCache(body, cache, {node, ele}, opt.mass,
+                                         opt.edge_compliance,
+                                         opt.volume_compliance))
+    return body;
+  body.initSoftBody(node, ele, opt.mass, opt.edge_compliance,
+                    opt.volume_compliance, &pool);
+  if (opt.use_cache && !writeSoftBodyCache(body, cache, {node, ele}, opt.mass))
+    std::cerr << "ERROR::SOFTBODY_CACHE::CANNOT_WRITE " << cache << std::endl;
+  return body;
+}
+
+// Lays the copies out side by side along x so they do not overlap.
+void placeBodies(std::vector<Mesh> &bodies) {
+  if (bodies.size() < 2 || bodies[0].particles.empty())
+    return;
+  float min_x = bodies[0].particles[0].pos.x;
+  float max_x = min_x;
+  for (Particle &p : bodies[0].particles) {
+    min_x = std::min(min_x, p.pos.x);
+    max_x = std::max(max_x, p.pos.x);
+  }
+  float spacing = (max_x - min_x) * 1.5f + 0.1f;
+  for (size_t b = 1; b < bodies.size(); b++) {
+    glm::vec3 offset = {spacing * b, 0, 0};
+    for (Particle &p : bodies[b].particles) {
+      p.pos += offset;
+      p.prev_pos += offset;
+    }
+    for (Particle &p : bodies[b].particle_reset) {
+      p.pos += offset;
+      p.prev_pos += offset;
+    }
+  }
+}
+
+bool writeNodeFile(const std::string &path, const std::vector<Mesh> &bodies) {
+  std::ofstream file(path);
+  if (!file) {
+    std::cerr << "Cannot write " << path << std::endl;
+    return false;
+  }
+  size_t count = 0;
+  for (const Mesh &b : bodies)
+    count += b.particles.size();
+  file << count << "  3  0  0\n" << std::setprecision(17);
+  size_t id = 1;
+  for (const Mesh &b : bodies) {
+    for (const Particle &p : b.particles) {
+      file << id++ << "  " << p.pos.x << "  " << p.pos.y << "  " << p.pos.z
+           << "\n";
+    }
+  }
+  file << "# Generated by slimeSim\n";
+  return true;
+}
+
+double percentile(std::vector<double> sorted, double q) {
+  if (sorted.empty())
+    return 0.0;
+  std::sort(sorted.begin(), sorted.end());
+  size_t idx = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+int main(int argc, char *argv[]) {
+  SimOptions opt;
+  if (!parse_options(argc, argv, opt)) {
+    print_usage();
+    return 1;
+  }
+
+  if (!opt.pack_path.empty() &&
+      !AssetPack::get().open(opt.pack_path, FileSystem::getPath("")))
+    return 1;
+
+  InputReplayer replayer;
+  if (!opt.replay_path.empty()) {
+    if (!replayer.open(opt.replay_path))
+      return 1;
+    opt.object = replayer.object_name;
+  }
+
+  Profiler::get().setThreadName("main");
+  Profiler::get().enabled = !opt.trace_path.empty();
+
+  ThreadPool pool(opt.threads);
+  auto load_start = std::chrono::steady_clock::now();
+  Mesh prototype({}, {}, {}, true);
+  if (!opt.generate.empty()) {
+    TetShape shape;
+    if (!parseTetShape(opt.generate, shape)) {
+      std::cerr << "Unknown shape " << opt.generate << std::endl;
+      return 1;
+    }
+    TetMeshData data = generateTetMesh(shape, opt.resolution);
+    if (!opt.export_base.empty() && !writeTetGenFiles(data, opt.export_base))
+      return 1;
+    prototype.initSoftBody(data.nodes, data.tets, opt.mass,
+                           opt.edge_compliance, opt.volume_compliance,
+                           &pool);
+    opt.object = opt.generate + std::to_string(opt.resolution);
+  } else {
+    prototype = loadSoftBody(opt, opt.object, pool);
+  }
+  std::vector<Mesh> bodies(opt.bodies, prototype);
+  placeBodies(bodies);
+  double load_ms = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - load_start)
+                       .count();
+
+  if (bodies[0].particles.empty()) {
+    std::cerr << "No particles loaded for " << opt.object << std::endl;
+    return 1;
+  }
+
+  std::cout << "slimeSim: " << opt.object << " x" << opt.bodies << ", "
+            << bodies[0].particles.size() << " particles, "
+            << bodies[0].tetrahedrons.size() << " tets, "
+            << bodies[0].edges.size() << " edges per body, loaded in "
+            << load_ms << " ms" << std::endl;
+
+  glm::vec3 gravity = {0, -10, 0};
+  int substeps = opt.substeps;
+
+  Particle *grabbed_particle = nullptr;
+  float grab_t = 0.0f;
+
+  std::vector<double> frame_ms;
+  frame_ms.reserve(opt.frames);
+  double total_substeps = 0;
+  double total_constraints = 0;
+
+  auto sim_start = std::chrono::steady_clock::now();
+  // a replay runs to its end unless --frames caps it
+  for (int frame = 0;
+       frame < opt.frames || (replayer.is_open() && !opt.frames_set);
+       frame++) {
+    PROFILE_ZONE("frame");
+    FrameInput in;
+    float dt = opt.dt;
+    if (replayer.is_open()) {
+      if (!replayer.next(in))
+        break;
+      if (opt.recorded_dt)
+        dt = in.dt;
+      substeps = in.substeps;
+      for (Mesh &b : bodies) {
+        b.edge_compliance = in.edge_compliance;
+        b.volume_compliance = in.volume_compliance;
+      }
+      if (in.lift) {
+        for (Particle &p : bodies[0].particles)
+          p.pos += glm::vec3(0, 0.01f, 0);
+      }
+    }
+
+    auto frame_start = std::chrono::steady_clock::now();
+    pool.parallel_for(bodies.size(), [&](size_t begin, size_t end, unsigned) {
+      for (size_t b = begin; b < end; b++)
+        bodies[b].update(dt, substeps, gravity);
+    });
+    frame_ms.push_back(std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - frame_start)
+                           .count());
+
+    total_substeps += substeps * bodies.size();
+    for (Mesh &b : bodies)
+      total_constraints +=
+          double(substeps) * (b.edges.size() + b.tetrahedrons.size());
+
+    // same order as the interactive loop: reset, then grab/release
+    if (replayer.is_open()) {
+      if (in.reset)
+        bodies[0].reset();
+      if (in.grab) {
+        if (grabbed_particle == nullptr) {
+          if (in.pick_particle >= 0 &&
+              in.pick_particle < (int)bodies[0].particles.size()) {
+            grabbed_particle = &bodies[0].particles[in.pick_particle];
+            grab_t = in.pick_t;
+          }
+        } else {
+          grabbed_particle->inv_mass = 0.0f;
+          grabbed_particle->pos = in.cam_pos + grab_t * in.cam_front;
+        }
+      } else if (grabbed_particle != nullptr) {
+        grabbed_particle->inv_mass = grabbed_particle->mass;
+        grabbed_particle->velocity = glm::vec3(0.0f);
+        grabbed_particle = nullptr;
+      }
+    }
+  }
+  double total_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - sim_start)
+                        .count();
+
+  double sum_ms = 0;
+  double max_ms = 0;
+  for (double ms : frame_ms) {
+    sum_ms += ms;
+    max_ms = std::max(max_ms, ms);
+  }
+  double seconds = sum_ms / 1000.0;
+  std::cout << std::fixed << std::setprecision(3) << "frames: "
+            << frame_ms.size() << ", threads: " << pool.size()
+            << ", wall: " << total_ms << " ms\n"
+            << "frame ms: mean "
+            << (frame_ms.empty() ? 0.0 : sum_ms / frame_ms.size()) << ", p50 "
+            << percentile(frame_ms, 0.50) << ", p95 "
+            << percentile(frame_ms, 0.95) << ", max " << max_ms << "\n"
+            << std::setprecision(0)
+            << "substeps/s: " << (seconds > 0 ? total_substeps / seconds : 0)
+            << ", constraints/s: "
+            << (seconds > 0 ? total_constraints / seconds : 0) << std::endl;
+
+  if (!opt.timings_path.empty()) {
+    std::ofstream csv(opt.timings_path);
+    csv << "frame,ms\n";
+    for (size_t i = 0; i < frame_ms.size(); i++)
+      csv << i << "," << frame_ms[i] << "\n";
+  }
+  if (!opt.trace_path.empty() &&
+      !Profiler::get().writeChromeTrace(opt.trace_path))
+    return 1;
+  if (!opt.out_path.empty() && !writeNodeFile(opt.out_path, bodies))
+    return 1;
+  return 0;
+}
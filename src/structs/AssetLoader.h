@@ -0,0 +1,163 @@
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include "Model.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+
+enum AssetState { ASSET_LOADING, ASSET_UPLOADING, ASSET_READY, ASSET_FAILED };
+
+// Progress of one model load. The model may only be touched once the state
+// is ASSET_READY (or after AssetLoader::finish() returned true).
+struct ModelAsset {
+  string path;
+  std::atomic<int> state{ASSET_LOADING};
+  std::unique_ptr<Model> model;
+  // becomes ready when the CPU side (import, decode, prepare) is done
+  std::shared_future<void> loaded;
+  double load_ms = 0.0;
+
+  bool ready() const { return state.load() == ASSET_READY; }
+  bool failed() const { return state.load() == ASSET_FAILED; }
+};
+
+using ModelHandle = std::shared_ptr<ModelAsset>;
+
+// Loads models on worker threads and finishes them on the GL thread. Workers
+// run the Assimp import (or a custom build step), texture decodes and an
+// optional prepare step (e.g. soft body setup), then queue the model for
+// upload. The render loop calls pumpUploads() once per frame with a time
+// budget, so streaming content in never stalls a frame for long.
+class AssetLoader {
+public:
+  // at least two workers so loads overlap with the main thread
+  explicit AssetLoader(unsigned int thread_count = std::max(
+                           2u, std::thread::hardware_concurrency()))
+      : pool(thread_count) {}
+
+  ModelHandle loadModel(const string &path,
+                        std::function<void(Model &)> prepare = nullptr,
+                        bool gamma = false) {
+    return buildModel(path, [path, prepare, gamma] {
+      auto model = std::make_unique<Model>(path, gamma, true);
+      if (prepare && !model->meshes.empty())
+        prepare(*model);
+      return model;
+    });
+  }
+
+  // Like loadModel(), but build creates the model on the worker, e.g. from
+  // data Assimp can't import. It must defer its uploads. name is only used
+  // for reporting.
+  ModelHandle buildModel(const string &name,
+                         std::function<std::unique_ptr<Model>()> build) {
+    ModelHandle handle = std::make_shared<ModelAsset>();
+    handle->path = name;
+    // the task state outlives the run and handle owns it through loaded, so
+    // the task only holds a weak reference
+    std::weak_ptr<ModelAsset> weak = handle;
+    auto task = [this, weak, build] {
+      if (ModelHandle asset = weak.lock())
+        load(asset, build);
+    };
+    handle->loaded = pool.submit(task).share();
+    return handle;
+  }
+
+  // Runs queued GL uploads on the calling (GL) thread until budget_ms is
+  // spent. At least one step runs per call so uploads always make progress.
+  // Returns the number of models that became ready.
+  int pumpUploads(double budget_ms) {
+    PROFILE_ZONE("AssetLoader::pumpUploads");
+    auto start = std::chrono::steady_clock::now();
+    int finished = 0;
+    while (true) {
+      ModelHandle handle;
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (upload_queue.empty())
+          break;
+        handle = upload_queue.front();
+      }
+      if (handle->model->uploadStep()) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        upload_queue.pop_front();
+        handle->state = ASSET_READY;
+        finished++;
+      }
+      double spent = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+      if (spent >= budget_ms)
+        break;
+    }
+    return finished;
+  }
+
+  // Blocks until the model is ready, uploading everything queued ahead of it
+  // without a budget. Returns false if the load failed.
+  bool finish(const ModelHandle &handle) {
+    handle->loaded.wait();
+    while (handle->state.load() == ASSET_UPLOADING)
+      pumpUploads(std::numeric_limits<double>::infinity());
+    return handle->ready();
+  }
+
+  size_t pendingUploads() {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return upload_queue.size();
+  }
+
+private:
+  std::mutex queue_mutex;
+  std::deque<ModelHandle> upload_queue;
+  // declared last so it is destroyed first: its destructor waits for the
+  // running and queued loads, which still push into upload_queue
+  ThreadPool pool;
+
+  void load(const ModelHandle &handle,
+            const std::function<std::unique_ptr<Model>()> &build) {
+    PROFILE_ZONE("AssetLoader::load");
+    auto start = std::chrono::steady_clock::now();
+    // an exception would only reach the task's future, which nobody reads
+    try {
+      handle->model = build();
+    } catch (const std::exception &e) {
+      std::cerr << "ERROR::ASSET_LOADER::LOAD_FAILED " << handle->path << ": "
+                << e.what() << std::endl;
+      handle->state = ASSET_FAILED;
+      return;
+    } catch (...) {
+      std::cerr << "ERROR::ASSET_LOADER::LOAD_FAILED " << handle->path
+                << std::endl;
+      handle->state = ASSET_FAILED;
+      return;
+    }
+    if (!handle->model || handle->model->meshes.empty()) {
+      std::cerr << "ERROR::ASSET_LOADER::NO_MESHES " << handle->path
+                << std::endl;
+      handle->state = ASSET_FAILED;
+      return;
+    }
+    handle->load_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    handle->state = ASSET_UPLOADING;
+    upload_queue.push_back(handle);
+  }
+};
+
+#endif // !ASSETLOADER_H
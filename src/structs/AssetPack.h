@@ -0,0 +1,256 @@
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Single file archive of the assets directory. The pack is mapped once and
+// files are served as views into the mapping, so loading a model opens no
+// files. Names are paths relative to the root the pack was built from, with
+// '/' separators.
+//
+// Layout: AssetPackHeader | AssetPackEntry[entry_count] | names, then every
+// blob aligned to ASSET_PACK_ALIGNMENT so it starts on its own page.
+
+const char ASSET_PACK_MAGIC[4] = {'S', 'L', 'P', 'K'};
+const uint32_t ASSET_PACK_VERSION = 1;
+const uint64_t ASSET_PACK_ALIGNMENT = 4096;
+
+struct AssetPackHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t names_size;
+};
+
+struct AssetPackEntry {
+  uint64_t offset;
+  uint64_t size;
+  uint32_t name_offset;
+  uint32_t name_size;
+};
+
+inline uint64_t packAlign(uint64_t offset) {
+  return (offset + ASSET_PACK_ALIGNMENT - 1) & ~(ASSET_PACK_ALIGNMENT - 1);
+}
+
+// Writes the files under root with the given relative names into a pack at
+// out_path. Returns false if a file can't be read or the pack can't be
+// written.
+inline bool writeAssetPack(const std::string &root,
+                           const std::vector<std::string> &names,
+                           const std::string &out_path) {
+  std::vector<AssetPackEntry> entries(names.size());
+  std::string name_table;
+  for (size_t i = 0; i < names.size(); i++) {
+    std::error_code ec;
+    entries[i].size = std::filesystem::file_size(
+        std::filesystem::path(root) / names[i], ec);
+    if (ec) {
+      std::cerr << "ERROR::ASSET_PACK::FILE_NOT_FOUND " << names[i]
+                << std::endl;
+      return false;
+    }
+    entries[i].name_offset = name_table.size();
+    entries[i].name_size = names[i].size();
+    name_table += names[i];
+  }
+
+  AssetPackHeader h;
+  std::memcpy(h.magic, ASSET_PACK_MAGIC, 4);
+  h.version = ASSET_PACK_VERSION;
+  h.entry_count = entries.size();
+  h.names_size = name_table.size();
+  uint64_t offset = sizeof(h) + entries.size() * sizeof(AssetPackEntry) +
+                    name_table.size();
+  for (AssetPackEntry &entry : entries) {
+    entry.offset = packAlign(offset);
+    offset = entry.offset + entry.size;
+  }
+
+  // write to a temporary name first so a crash never leaves a torn pack
+  std::string tmp_path = out_path + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    std::cerr << "ERROR::ASSET_PACK::CANNOT_WRITE " << out_path << std::endl;
+    return false;
+  }
+  file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  file.write(reinterpret_cast<const char *>(entries.data()),
+             entries.size() * sizeof(AssetPackEntry));
+  file.write(name_table.data(), name_table.size());
+  offset = sizeof(h) + entries.size() * sizeof(AssetPackEntry) +
+           name_table.size();
+  std::vector<char> buffer;
+  for (size_t i = 0; i < names.size(); i++) {
+    static const char zeros[ASSET_PACK_ALIGNMENT] = {};
+    file.write(zeros, entries[i].offset - offset);
+    std::ifstream in(std::filesystem::path(root) / names[i],
+                     std::ios::binary);
+    buffer.resize(entries[i].size);
+    if (!in.read(buffer.data(), buffer.size())) {
+      std::cerr << "ERROR::ASSET_PACK::FILE_NOT_SUCCESSFULLY_READ "
+                << names[i] << std::endl;
+      file.close();
+      std::error_code ec;
+      std::filesystem::remove(tmp_path, ec);
+      return false;
+    }
+    file.write(buffer.data(), buffer.size());
+    offset = entries[i].offset + entries[i].size;
+  }
+  file.close();
+  std::error_code ec;
+  if (!file) {
+    std::filesystem::remove(tmp_path, ec);
+    return false;
+  }
+  std::filesystem::rename(tmp_path, out_path, ec);
+  return !ec;
+}
+
+// The pack currently serving reads. Open it before any loads start; lookups
+// are lock free afterwards and safe from the loader threads.
+class AssetPack {
+public:
+  static AssetPack &get() {
+    static AssetPack instance;
+    return instance;
+  }
+
+  // Maps the pack and routes MappedFile reads of paths under root to it.
+  bool open(const std::string &pack_path, const std::string &root) {
+    close();
+    if (!file.open(pack_path) || file.size() < sizeof(AssetPackHeader)) {
+      std::cerr << "ERROR::ASSET_PACK::CANNOT_OPEN " << pack_path << std::endl;
+      file.close();
+      return false;
+    }
+    AssetPackHeader h;
+    std::memcpy(&h, file.data(), sizeof(h));
+    uint64_t names_start =
+        sizeof(h) + uint64_t(h.entry_count) * sizeof(AssetPackEntry);
+    if (std::memcmp(h.magic, ASSET_PACK_MAGIC, 4) != 0 ||
+        h.version != ASSET_PACK_VERSION ||
+        names_start + h.names_size > file.size()) {
+      std::cerr << "ERROR::ASSET_PACK::INVALID_PACK " << pack_path << std::endl;
+      file.close();
+      return false;
+    }
+
+    const char *names = file.data() + names_start;
+    entries.reserve(h.entry_count);
+    for (uint32_t i = 0; i < h.entry_count; i++) {
+      AssetPackEntry entry;
+      std::memcpy(&entry, file.data() + sizeof(h) + i * sizeof(entry),
+                  sizeof(entry));
+      if (uint64_t(entry.name_offset) + entry.name_size > h.names_size ||
+          entry.offset > file.size() ||
+          entry.size > file.size() - entry.offset) {
+        std::cerr << "ERROR::ASSET_PACK::INVALID_ENTRY " << i << std::endl;
+        close();
+        return false;
+      }
+      entries.emplace(std::string_view(names + entry.name_offset,
+                                       entry.name_size),
+                      std::string_view(file.data() + entry.offset,
+                                       entry.size));
+    }
+
+    std::error_code ec;
+    std::filesystem::path abs_root =
+        std::filesystem::absolute(root, ec).lexically_normal();
+    roots.push_back(abs_root);
+    // texture paths arrive canonicalized, with symlinks resolved
+    std::filesystem::path canonical_root =
+        std::filesystem::weakly_canonical(abs_root, ec);
+    if (!ec && canonical_root != abs_root)
+      roots.push_back(canonical_root);
+    pack_mtime = std::filesystem::last_write_time(pack_path, ec)
+                     .time_since_epoch()
+                     .count();
+    MappedFile::resolver = &AssetPack::resolve;
+    return true;
+  }
+
+  void close() {
+    if (MappedFile::resolver == &AssetPack::resolve)
+      MappedFile::resolver = nullptr;
+    entries.clear();
+    roots.clear();
+    file.close();
+  }
+
+  bool isOpen() const { return file.good(); }
+  size_t size() const { return entries.size(); }
+  // Modification time of the pack, which stands in for the time of every
+  // file it serves.
+  int64_t mtime() const { return pack_mtime; }
+
+  // Looks up a file by its path on disk. Returns false if the pack doesn't
+  // hold it.
+  bool view(const std::string &path, std::string_view &out) const {
+    if (entries.empty())
+      return false;
+    std::string name = relativeName(path);
+    if (name.empty())
+      return false;
+    auto it = entries.find(name);
+    if (it == entries.end())
+      return false;
+    out = it->second;
+    return true;
+  }
+
+  // Entry names and blobs in no particular order.
+  const std::unordered_map<std::string_view, std::string_view> &
+  contents() const {
+    return entries;
+  }
+
+private:
+  MappedFile file;
+  // name -> blob, both pointing into the mapping
+  std::unordered_map<std::string_view, std::string_view> entries;
+  std::vector<std::filesystem::path> roots;
+  int64_t pack_mtime = 0;
+
+  AssetPack() = default;
+
+  // path relative to the pack root, or empty if it lies outside of it
+  std::string relativeName(const std::string &path) const {
+    std::error_code ec;
+    std::filesystem::path p =
+        std::filesystem::absolute(path, ec).lexically_normal();
+    if (ec)
+      return "";
+    for (const std::filesystem::path &root : roots) {
+      std::filesystem::path rel = p.lexically_relative(root);
+      if (!rel.empty() && *rel.begin() != "..")
+        return rel.generic_string();
+    }
+    return "";
+  }
+
+  static bool resolve(const std::string &path, const char *&data,
+                      size_t &size) {
+    std::string_view blob;
+    if (!get().view(path, blob))
+      return false;
+    data = blob.data();
+    size = blob.size();
+    return true;
+  }
+};
+
+#endif // !ASSETPACK_H
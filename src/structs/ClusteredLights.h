@@ -0,0 +1,262 @@
+#ifndef CLUSTEREDLIGHTS_H
+#define CLUSTEREDLIGHTS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "UniformBlocks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// A point light, laid out the way texture2.frag reads it from the light
+// buffer texture: four RGBA32F texels per light. Positions are in world
+// space; the light is ignored beyond radius.
+struct PointLight {
+  glm::vec3 position = glm::vec3(0.0f);
+  float radius = 0.0f;
+  glm::vec3 ambient = glm::vec3(0.0f);
+  float constant = 1.0f;
+  glm::vec3 diffuse = glm::vec3(0.0f);
+  float linear = 0.0f;
+  glm::vec3 specular = glm::vec3(0.0f);
+  float quadratic = 0.0f;
+};
+
+static_assert(sizeof(PointLight) == 64, "PointLight texel layout");
+
+// Distance at which the attenuation brings the brightest channel of the
+// light below 1/256, where it stops being visible.
+inline float attenuationRadius(const PointLight &light) {
+  float brightest = 0.0f;
+  for (const glm::vec3 &color : {light.ambient, light.diffuse, light.specular})
+    brightest = std::max({brightest, color.r, color.g, color.b});
+  // constant + linear d + quadratic d^2 = 256 brightest
+  float c = light.constant - 256.0f * brightest;
+  if (c >= 0.0f)
+    return 0.0f;
+  if (light.quadratic > 0.0f)
+    return (-light.linear + std::sqrt(light.linear * light.linear -
+                                      4.0f * light.quadratic * c)) /
+           (2.0f * light.quadratic);
+  if (light.linear > 0.0f)
+    return -c / light.linear;
+  return std::numeric_limits<float>::max();
+}
+
+// Clustered forward lighting. The view frustum is split into tiles on
+// screen and exponential depth slices, and every frame each point light is
+// binned into the clusters its bounding sphere overlaps. The fragment
+// shader looks up its cluster and only shades the lights listed there, so
+// its cost follows the lights that reach it rather than the light count.
+//
+// The shader reads three buffer textures: the lights, per cluster an
+// (offset, count) pair into the index list, and the index list itself.
+class ClusteredLights {
+public:
+  static const int TILES_X = 16;
+  static const int TILES_Y = 9;
+  static const int SLICES = 24;
+  static const int CLUSTERS = TILES_X * TILES_Y * SLICES;
+  // GL 3.3 only guarantees buffer textures of 65536 texels; upload() raises
+  // the limit to what the driver supports for the following bins
+  static const size_t MIN_TEXTURE_BUFFER_SIZE = 65536;
+
+  // Bins the lights into the clusters of a symmetric perspective camera.
+  // CPU only, see upload().
+  void bin(const std::vector<PointLight> &lights, const glm::mat4 &view,
+           const glm::mat4 &projection, float z_near, float z_far,
+           int viewport_width, int viewport_height) {
+    // indices are 16 bit
+    size_t max_lights = std::min<size_t>(max_texels / 4, 65536);
+    size_t n = std::min(lights.size(), max_lights);
+    this->lights.assign(lights.begin(), lights.begin() + n);
+    float log_range = std::log(z_far / z_near);
+    cluster_block.grid = glm::uvec4(TILES_X, TILES_Y, SLICES, n);
+    cluster_block.scale =
+        glm::vec4(float(TILES_X) / std::max(viewport_width, 1),
+                  float(TILES_Y) / std::max(viewport_height, 1),
+                  SLICES / log_range, -SLICES * std::log(z_near) / log_range);
+
+    // World positions are gathered into one array per component first, so
+    // the transform to view space below runs over plain arrays and
+    // vectorizes (at -O3).
+    center_x.resize(n);
+    center_y.resize(n);
+    depth_min.resize(n);
+    depth_max.resize(n);
+    radius.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      center_x[i] = this->lights[i].position.x;
+      center_y[i] = this->lights[i].position.y;
+      depth_min[i] = this->lights[i].position.z;
+      radius[i] = std::min(this->lights[i].radius, z_far);
+    }
+    const float m00 = view[0][0], m10 = view[1][0], m20 = view[2][0],
+                m30 = view[3][0], m01 = view[0][1], m11 = view[1][1],
+                m21 = view[2][1], m31 = view[3][1], m02 = view[0][2],
+                m12 = view[1][2], m22 = view[2][2], m32 = view[3][2];
+    for (size_t i = 0; i < n; i++) {
+      float x = center_x[i], y = center_y[i], z = depth_min[i];
+      float depth = -(m02 * x + m12 * y + m22 * z + m32);
+      center_x[i] = m00 * x + m10 * y + m20 * z + m30;
+      center_y[i] = m01 * x + m11 * y + m21 * z + m31;
+      depth_min[i] = std::max(depth - radius[i], z_near);
+      depth_max[i] = std::min(depth + radius[i], z_far);
+    }
+
+    // cluster ranges of the lights' view space bounding boxes. x / depth is
+    // monotonic in depth, so the extremes lie at the near or far end.
+    ranges.clear();
+    for (size_t i = 0; i < n; i++) {
+      if (depth_min[i] > depth_max[i])
+        continue; // in front of the near plane or beyond the far one
+      ClusterRange range;
+      range.light = i;
+      float near_scale = 1.0f / depth_min[i], far_scale = 1.0f / depth_max[i];
+      tileRange(center_x[i], radius[i], projection[0][0], near_scale,
+                far_scale, TILES_X, range.x0, range.x1);
+      tileRange(center_y[i], radius[i], projection[1][1], near_scale,
+                far_scale, TILES_Y, range.y0, range.y1);
+      range.z0 = slice(depth_min[i]);
+      range.z1 = slice(depth_max[i]);
+      ranges.push_back(range);
+    }
+
+    // counting sort of the (cluster, light) pairs into per cluster lists
+    grid.assign(2 * CLUSTERS, 0);
+    forEachCluster([&](int cluster, uint32_t) { grid[2 * cluster + 1]++; });
+    uint32_t offset = 0;
+    dropped = 0;
+    for (int cluster = 0; cluster < CLUSTERS; cluster++) {
+      uint32_t count = grid[2 * cluster + 1];
+      uint32_t kept = std::min<size_t>(count, max_texels - offset);
+      dropped += count - kept;
+      grid[2 * cluster] = offset;
+      grid[2 * cluster + 1] = kept;
+      offset += kept;
+    }
+    indices.resize(offset);
+    fill.assign(CLUSTERS, 0);
+    forEachCluster([&](int cluster, uint32_t light) {
+      if (fill[cluster] < grid[2 * cluster + 1])
+        indices[grid[2 * cluster] + fill[cluster]++] = light;
+    });
+  }
+
+  // Uploads the result of the last bin() and binds the buffer textures to
+  // their units. GL thread only.
+  void upload() {
+    if (buffers[0] == 0) {
+      glGenBuffers(3, buffers);
+      glGenTextures(3, textures);
+      const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+      for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+      }
+      GLint size = 0;
+      glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &size);
+      max_texels = std::max<size_t>(size, MIN_TEXTURE_BUFFER_SIZE);
+    }
+    // orphaned like the streamed vertices; never empty so the texture
+    // always has storage
+    PointLight no_light;
+    uint16_t no_index = 0;
+    streamBuffer(buffers[0], lights.size() * sizeof(PointLight),
+                 lights.empty() ? (const void *)&no_light : lights.data(),
+                 sizeof(no_light));
+    streamBuffer(buffers[1], grid.size() * sizeof(uint32_t), grid.data(), 0);
+    streamBuffer(buffers[2], indices.size() * sizeof(uint16_t),
+                 indices.empty() ? (const void *)&no_index : indices.data(),
+                 sizeof(no_index));
+    const GLuint units[3] = {LIGHT_DATA_UNIT, LIGHT_GRID_UNIT,
+                             LIGHT_INDEX_UNIT};
+    for (int i = 0; i < 3; i++) {
+      glActiveTexture(GL_TEXTURE0 + units[i]);
+      glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Grid parameters for the Lights uniform block.
+  const ClusterBlock &block() const { return cluster_block; }
+
+  // Lights that reach the view, (cluster, light) pairs and pairs that did
+  // not fit in the index list in the last bin().
+  size_t lightsInView() const { return ranges.size(); }
+  size_t lightReferences() const { return indices.size(); }
+  size_t droppedReferences() const { return dropped; }
+
+  void release() {
+    if (buffers[0] != 0) {
+      glDeleteTextures(3, textures);
+      glDeleteBuffers(3, buffers);
+    }
+    for (int i = 0; i < 3; i++)
+      buffers[i] = textures[i] = 0;
+  }
+
+private:
+  struct ClusterRange {
+    uint32_t light;
+    int x0, x1, y0, y1, z0, z1;
+  };
+
+  std::vector<PointLight> lights;
+  std::vector<float> center_x, center_y, depth_min, depth_max, radius;
+  std::vector<ClusterRange> ranges;
+  // per cluster offset into indices and count
+  std::vector<uint32_t> grid;
+  std::vector<uint16_t> indices;
+  std::vector<uint32_t> fill;
+  size_t dropped = 0;
+  size_t max_texels = MIN_TEXTURE_BUFFER_SIZE;
+  ClusterBlock cluster_block = {};
+  // lights, grid, indices
+  GLuint buffers[3] = {0, 0, 0};
+  GLuint textures[3] = {0, 0, 0};
+
+  // Same formula as clusterIndex() in texture2.frag.
+  int slice(float depth) const {
+    int s = int(std::floor(std::log(depth) * cluster_block.scale.z +
+                           cluster_block.scale.w));
+    return std::clamp(s, 0, SLICES - 1);
+  }
+
+  // Tiles covered on one axis by [center - r, center + r] seen between the
+  // near and far depth of the light.
+  static void tileRange(float center, float r, float focal, float near_scale,
+                        float far_scale, int tiles, int &first, int &last) {
+    float lo = std::min((center - r) * near_scale, (center - r) * far_scale);
+    float hi = std::max((center + r) * near_scale, (center + r) * far_scale);
+    lo = std::clamp(lo * focal, -1.0f, 1.0f);
+    hi = std::clamp(hi * focal, -1.0f, 1.0f);
+    first = std::clamp(int((lo * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+    last = std::clamp(int((hi * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+  }
+
+  template <typename F> void forEachCluster(F &&visit) const {
+    for (const ClusterRange &r : ranges)
+      for (int z = r.z0; z <= r.z1; z++)
+        for (int y = r.y0; y <= r.y1; y++)
+          for (int x = r.x0; x <= r.x1; x++)
+            visit(x + TILES_X * (y + TILES_Y * z), r.light);
+  }
+
+  static void streamBuffer(GLuint buffer, size_t bytes, const void *data,
+                           size_t min_bytes) {
+    bytes = std::max(bytes, min_bytes);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+  }
+};
+
+#endif // !CLUSTEREDLIGHTS_H
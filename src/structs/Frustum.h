@@ -0,0 +1,66 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// The six clip planes of a view-projection matrix in world space, as
+// a x + b y + c z + d >= 0 for points inside, with (a, b, c) normalized so
+// the left side is a distance. Extracted from the matrix rows (Gribb and
+// Hartmann), in the order left, right, bottom, top, near, far.
+struct Frustum {
+  glm::vec4 planes[6];
+
+  static Frustum fromViewProjection(const glm::mat4 &m) {
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+      row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    Frustum f;
+    for (int axis = 0; axis < 3; axis++) {
+      f.planes[2 * axis] = row[3] + row[axis];
+      f.planes[2 * axis + 1] = row[3] - row[axis];
+    }
+    for (glm::vec4 &plane : f.planes)
+      plane /= glm::length(glm::vec3(plane));
+    return f;
+  }
+
+  bool intersectsSphere(const glm::vec3 &center, float radius) const {
+    for (const glm::vec4 &plane : planes)
+      if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        return false;
+    return true;
+  }
+};
+
+// Tests n spheres, given as separate center and radius arrays, against the
+// frustum and sets visible[i] to 0 or 1. The planes are laid out by
+// component and padded to eight with planes every sphere passes, so the
+// distances of one sphere to all planes are computed in a fixed length loop
+// the compiler turns into SIMD code, also at -O2.
+inline void cullSpheres(const Frustum &frustum, const float *x,
+                        const float *y, const float *z, const float *radius,
+                        size_t n, uint8_t *visible) {
+  float a[8], b[8], c[8], d[8];
+  for (int k = 0; k < 8; k++) {
+    glm::vec4 plane = k < 6 ? frustum.planes[k] : glm::vec4(0, 0, 0, 1);
+    a[k] = plane.x;
+    b[k] = plane.y;
+    c[k] = plane.z;
+    d[k] = plane.w;
+  }
+  for (size_t i = 0; i < n; i++) {
+    float distance[8];
+    for (int k = 0; k < 8; k++)
+      distance[k] = a[k] * x[i] + b[k] * y[i] + c[k] * z[i] + d[k] + radius[i];
+    float nearest = distance[0];
+    for (int k = 1; k < 8; k++)
+      nearest = std::min(nearest, distance[k]);
+    visible[i] = nearest >= 0.0f;
+  }
+}
+
+#endif // !FRUSTUM_H
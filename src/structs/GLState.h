@@ -0,0 +1,129 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Binds counted by GLStateCache: issued went to the driver, skipped were
+// already current.
+struct RenderStats {
+  uint64_t draws = 0;
+  // objects drawn, more than draws when draws are instanced
+  uint64_t instances = 0;
+  // objects skipped by frustum culling
+  uint64_t culled = 0;
+  uint64_t program_binds = 0;
+  uint64_t program_binds_skipped = 0;
+  uint64_t vao_binds = 0;
+  uint64_t vao_binds_skipped = 0;
+  uint64_t texture_binds = 0;
+  uint64_t texture_binds_skipped = 0;
+};
+
+// Shadow copy of the GL binding state the draw path touches, so redundant
+// binds never reach the driver. The cache only knows what went through it:
+// call invalidate() whenever other code (ImGui, mesh uploads) may have bound
+// something since.
+class GLStateCache {
+public:
+  static const int MAX_TEXTURE_UNITS = 16;
+
+  GLStateCache() { invalidate(); }
+
+  void invalidate() {
+    program = UNKNOWN;
+    vao = UNKNOWN;
+    active_unit = UNKNOWN;
+    for (GLuint &texture : textures)
+      texture = UNKNOWN;
+    samplers.clear();
+  }
+
+  // Returns true if the program changed.
+  bool useProgram(GLuint id) {
+    if (id == program) {
+      stats.program_binds_skipped++;
+      return false;
+    }
+    glUseProgram(id);
+    program = id;
+    samplers.clear();
+    stats.program_binds++;
+    return true;
+  }
+
+  void bindVertexArray(GLuint id) {
+    if (id == vao) {
+      stats.vao_binds_skipped++;
+      return;
+    }
+    glBindVertexArray(id);
+    vao = id;
+    stats.vao_binds++;
+  }
+
+  void bindTexture(GLuint unit, GLuint id) {
+    if (unit < MAX_TEXTURE_UNITS && textures[unit] == id) {
+      stats.texture_binds_skipped++;
+      return;
+    }
+    activeTexture(unit);
+    glBindTexture(GL_TEXTURE_2D, id);
+    if (unit < MAX_TEXTURE_UNITS)
+      textures[unit] = id;
+    stats.texture_binds++;
+  }
+
+  // Points a sampler uniform of the current program at a texture unit.
+  void setSampler(GLint location, GLint unit) {
+    auto it = std::find_if(samplers.begin(), samplers.end(),
+                           [&](const std::pair<GLint, GLint> &sampler) {
+                             return sampler.first == location;
+                           });
+    if (it != samplers.end() && it->second == unit)
+      return;
+    glUniform1i(location, unit);
+    if (it != samplers.end())
+      it->second = unit;
+    else
+      samplers.push_back({location, unit});
+  }
+
+  void activeTexture(GLuint unit) {
+    if (unit == active_unit)
+      return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active_unit = unit;
+  }
+
+  void countDraw(uint64_t instances = 1) {
+    stats.draws++;
+    stats.instances += instances;
+  }
+
+  void countCulled(uint64_t n) { stats.culled += n; }
+
+  // Returns and resets the counters.
+  RenderStats takeStats() {
+    RenderStats taken = stats;
+    stats = RenderStats();
+    return taken;
+  }
+
+private:
+  static const GLuint UNKNOWN = ~0u;
+
+  GLuint program = UNKNOWN;
+  GLuint vao = UNKNOWN;
+  GLuint active_unit = UNKNOWN;
+  GLuint textures[MAX_TEXTURE_UNITS];
+  // sampler uniform location -> unit, for the current program
+  std::vector<std::pair<GLint, GLint>> samplers;
+  RenderStats stats;
+};
+
+#endif // !GLSTATE_H
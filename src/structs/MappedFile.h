@@ -0,0 +1,104 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Memory mapped on POSIX systems, read into
+// memory elsewhere. Files held by an open AssetPack are served from the
+// pack's mapping instead.
+class MappedFile {
+public:
+  // Lets an archive serve files out of memory it already has mapped. Returns
+  // true with the file's bytes if it holds path.
+  static inline bool (*resolver)(const std::string &path, const char *&data,
+                                 size_t &size) = nullptr;
+
+  MappedFile() = default;
+  explicit MappedFile(const std::string &path) { open(path); }
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path) {
+    close();
+    if (resolver != nullptr && resolver(path, mapped, length)) {
+      borrowed = true;
+      is_open = true;
+      return true;
+    }
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    length = static_cast<size_t>(st.st_size);
+    if (length > 0) {
+      void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        length = 0;
+        return false;
+      }
+      madvise(p, length, MADV_SEQUENTIAL);
+      mapped = static_cast<const char *>(p);
+    }
+    ::close(fd);
+    is_open = true;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+    buffer.assign(std::istreambuf_iterator<char>(file),
+                  std::istreambuf_iterator<char>());
+    mapped = buffer.data();
+    length = buffer.size();
+    is_open = true;
+#endif
+    return true;
+  }
+
+  void close() {
+#ifndef _WIN32
+    if (mapped != nullptr && !borrowed)
+      munmap(const_cast<char *>(mapped), length);
+#else
+    buffer.clear();
+#endif
+    mapped = nullptr;
+    length = 0;
+    is_open = false;
+    borrowed = false;
+  }
+
+  bool good() const { return is_open; }
+  const char *data() const { return mapped; }
+  size_t size() const { return length; }
+  const char *begin() const { return mapped; }
+  const char *end() const { return mapped + length; }
+
+private:
+  const char *mapped = nullptr;
+  size_t length = 0;
+  bool is_open = false;
+  bool borrowed = false; // owned by the resolver, not unmapped on close
+#ifdef _WIN32
+  std::string buffer;
+#endif
+};
+
+#endif // !MAPPEDFILE_H
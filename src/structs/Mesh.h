@@ -7,16 +7,25 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "GLState.h"
 #include "Hit.h"
+#include "Profiler.h"
 #include "Ray.h"
 #include "Shader.h"
-
+#include "TetGenParser.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include <fstream>
-#include <regex>
 using namespace std;
 
 bool stick_floor = false;
@@ -58,6 +67,80 @@ struct Vertex {
   float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// Where each Vertex attribute goes on the GPU. On soft meshes the dynamic
+// attributes live in a tightly packed buffer of their own that is refilled
+// every frame, the rest in a static buffer uploaded once. Rigid meshes keep
+// everything in one interleaved buffer.
+struct VertexAttribute {
+  GLuint location;
+  GLint components;
+  GLenum type; // GL_INT attributes are bound with glVertexAttribIPointer
+  size_t offset; // in Vertex
+  bool dynamic;
+};
+
+const VertexAttribute VERTEX_LAYOUT[] = {
+    {0, 3, GL_FLOAT, offsetof(Vertex, Position), true},
+    {1, 3, GL_FLOAT, offsetof(Vertex, Normal), true},
+    {2, 2, GL_FLOAT, offsetof(Vertex, TexCoords), false},
+    {3, 3, GL_FLOAT, offsetof(Vertex, Tangent), false},
+    {4, 3, GL_FLOAT, offsetof(Vertex, Bitangent), false},
+    {5, 4, GL_INT, offsetof(Vertex, m_BoneIDs), false},
+    {6, 4, GL_FLOAT, offsetof(Vertex, m_Weights), false},
+};
+
+// One vertex buffer holding a subset of the Vertex attributes back to back.
+struct VertexStream {
+  unsigned int buffer = 0;
+  size_t stride = 0;
+  // byte ranges of Vertex copied into each packed vertex, adjacent
+  // attributes merged: {offset, size}
+  vector<std::pair<size_t, size_t>> spans;
+  vector<char> staging;
+
+  // Adds an attribute and returns its offset in the packed vertex.
+  size_t add(const VertexAttribute &a) {
+    size_t size = a.components * 4;
+    if (!spans.empty() &&
+        spans.back().first + spans.back().second == a.offset)
+      spans.back().second += size;
+    else
+      spans.push_back({a.offset, size});
+    stride += size;
+    return stride - size;
+  }
+
+  // The packed data is the Vertex array itself, no copy needed.
+  bool interleaved() const {
+    return spans.size() == 1 && spans[0].first == 0 &&
+           spans[0].second == sizeof(Vertex);
+  }
+
+  const void *pack(const vector<Vertex> &vertices) {
+    if (interleaved())
+      return vertices.data();
+    staging.resize(vertices.size() * stride);
+    char *out = staging.data();
+    for (const Vertex &v : vertices) {
+      const char *in = reinterpret_cast<const char *>(&v);
+      for (const auto &[offset, size] : spans) {
+        std::memcpy(out, in + offset, size);
+        out += size;
+      }
+    }
+    return staging.data();
+  }
+
+  void clear() {
+    if (buffer != 0)
+      glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    stride = 0;
+    spans.clear();
+    staging.clear();
+  }
+};
+
 struct Edge {
   glm::vec2 particle_ids;
   float rest_length;
@@ -91,224 +174,500 @@ struct Texture {
   string path;
 };
 
+// One texture of a compiled material: bound to unit, with the sampler
+// uniform at location pointing at that unit.
+struct MaterialBinding {
+  GLuint unit;
+  GLuint texture;
+  GLint location;
+};
+
+// Texture types in the order of their units: the n-th texture of a type
+// (counting from 1) goes to unit role + 4 * (n - 1), so every mesh uses the
+// same unit for the same sampler and sampler uniforms rarely change.
+const char *const MATERIAL_TEXTURE_TYPES[] = {
+    "texture_diffuse", "texture_specular", "texture_normal", "texture_height"};
+const char *const MATERIAL_SAMPLERS[] = {
+    "material.diffuse", "material.specular", "material.normal",
+    "material.height"};
+
 class Mesh {
 public:
   vector<Vertex> vertices;
   vector<unsigned int> indices;
   vector<Texture> textures;
-  unsigned int VAO;
+  unsigned int VAO = 0;
 
   // soft body attributes
   vector<Particle> particles;
   vector<Particle> particle_reset;
-  unordered_map<int, vector<int>> particle_vertex_map;
+  // particle driving each render vertex, -1 for vertices without one
+  vector<int> vertex_particle;
   vector<Tetrahedron> tetrahedrons;
   vector<Edge> edges;
   float edge_compliance;
   float volume_compliance;
+  // max distance between a render vertex and the particle that drives it
+  float weld_tolerance = 1e-5f;
+  // vertices that moved less than this keep their normals, see
+  // updateNormals()
+  float normal_tolerance = 1e-5f;
   bool is_soft;
+  // headless meshes never touch GL, so they can be simulated without a context
+  bool is_headless;
+  // Object space bounding box of what is drawn. Set at upload; soft bodies
+  // refresh it from the particles in post_solve.
+  glm::vec3 bounds_min = glm::vec3(0.0f);
+  glm::vec3 bounds_max = glm::vec3(0.0f);
+  // Cleared by the render queue while the mesh is outside the view, which
+  // makes update_vertices() skip the normals and the upload.
+  bool in_view = true;
 
   Mesh(vector<Vertex> vertices, vector<unsigned int> indices,
-       vector<Texture> textures) {
+       vector<Texture> textures, bool headless = false) {
     this->vertices = vertices;
     this->indices = indices;
     this->textures = textures;
     this->is_soft = false;
+    this->is_headless = headless;
+
+    if (!is_headless)
+      setupMesh();
+  }
 
+  // Creates the GL objects of a mesh that was built headless, e.g. on a
+  // loader thread. Must be called on the thread that owns the GL context.
+  void upload() {
+    is_headless = false;
     setupMesh();
   }
 
+  // With a pool the .ele parse and the rest volume pass run in parallel.
   void initSoftBody(const string &node_path, const string &tetIDpath,
-                    float mass, float edge_compliance,
-                    float volume_compliance) {
+                    float mass, float edge_compliance, float volume_compliance,
+                    ThreadPool *pool = nullptr) {
     this->is_soft = true;
     this->edge_compliance = edge_compliance;
     this->volume_compliance = volume_compliance;
     // this->addParticles(node_path, mass);
     // this->addTetraIDs(tetIDpath);
     this->addParticlesTetGen(node_path, mass);
-    this->addTetraIDsTetGen(tetIDpath);
+    this->addTetraIDsTetGen(tetIDpath, pool);
     this->calcEdges();
   }
 
-  void addParticles(const string &path, float mass) {
-    fstream f(path);
-    std::string line_buffer;
-
-    regex reg("\\s+");
+  // Builds the soft body from in-memory nodes and 0-based tets, e.g. from
+  // generateTetMesh(), without going through files.
+  void initSoftBody(const vector<glm::vec3> &nodes,
+                    const vector<glm::ivec4> &tets, float mass,
+                    float edge_compliance, float volume_compliance,
+                    ThreadPool *pool = nullptr) {
+    this->is_soft = true;
+    this->edge_compliance = edge_compliance;
+    this->volume_compliance = volume_compliance;
+    this->addParticleList(nodes, mass);
+    this->addTetrahedronList(tets, pool);
+    this->calcEdges();
+  }
 
-    while (getline(f, line_buffer)) {
-      sregex_token_iterator iter(line_buffer.begin(), line_buffer.end(), reg,
-                                 -1);
-      sregex_token_iterator end;
+  // Legacy "x z y" node list, see loadLegacyNodes()
+  void addParticles(const string &path, float mass) {
+    vector<glm::vec3> nodes;
+    if (!loadLegacyNodes(path, nodes))
+      std::cerr << "ERROR::MESH::CANNOT_READ " << path << "\n";
+    addParticleList(nodes, mass);
+  }
 
-      vector<string> vec(iter, end);
+  void addParticlesTetGen(const std::string &path, float mass) {
+    vector<glm::vec3> nodes;
+    if (!loadTetGenNodes(path, nodes))
+      std::cerr << "ERROR::MESH::CANNOT_READ " << path << "\n";
+    addParticleList(nodes, mass);
+  }
 
-      float arg1 = std::stof(vec[0]);
-      float arg2 = std::stof(vec[2]);
-      float arg3 = std::stof(vec[1]);
-      Particle p = Particle({arg1, arg2, arg3}, mass);
-      this->particles.push_back(p);
-    }
-    f.close();
+  void addParticleList(const vector<glm::vec3> &nodes, float mass) {
+    this->particles.reserve(this->particles.size() + nodes.size());
+    for (const glm::vec3 &pos : nodes)
+      this->particles.push_back(Particle(pos, mass));
     this->particle_reset = this->particles;
     create_particle_vertex_map();
-    return;
   }
 
-  void addParticlesTetGen(const std::string &path, float mass) {
-    std::ifstream file(path);
-    std::string line;
-    std::regex whitespace("\\s+");
-
-    // Skip the first line: that has number of vertices etc
-    std::getline(file, line);
-
-    while (std::getline(file, line)) {
-      // Remove leading/trailing spaces
-      line = std::regex_replace(line, std::regex("^\\s+|\\s+$"), "");
-
-      if (line.empty() || line[0] == '#')
-        continue; // skip empty/comment lines
-
-      std::sregex_token_iterator iter(line.begin(), line.end(), whitespace, -1);
-      std::sregex_token_iterator end;
-      std::vector<std::string> tokens(iter, end);
-
-      if (tokens.size() < 4) {
-        std::cerr << "Skipping short/malformed line: [" << line << "]\n";
+  // Fills vertex_particle: every render vertex is attached to the nearest
+  // particle within weld_tolerance. Particles are bucketed in a hash grid
+  // with cells twice the tolerance, so a match can only lie in the vertex's
+  // own cell or the neighbours on the side of the cell the vertex is in: 8
+  // cells in total. Positions whose cell does not fit an int (huge or NaN)
+  // are left out and their vertices stay unmatched.
+  void create_particle_vertex_map() {
+    vertex_particle.assign(vertices.size(), -1);
+    if (vertices.empty() || particles.empty())
+      return;
+    // a zero tolerance still needs a non-zero cell size
+    float cell = std::max(2.0f * weld_tolerance, 1e-6f);
+
+    // particles per cell as singly linked lists through next_in_cell
+    unordered_map<glm::ivec3, int, Vec3Hash> cell_head;
+    cell_head.reserve(particles.size());
+    vector<int> next_in_cell(particles.size(), -1);
+    for (int i = particles.size() - 1; i >= 0; i--) {
+      glm::vec3 scaled = glm::floor(particles[i].pos / cell);
+      if (!cellInRange(scaled))
         continue;
-      }
-
-      try {
-        float x = std::stof(tokens[1]);
-        float y = std::stof(tokens[2]);
-        float z = std::stof(tokens[3]);
-
-        Particle p(glm::vec3(x, y, z), mass);
-        this->particles.push_back(p);
-      } catch (const std::exception &e) {
-        std::cerr << "Invalid float data in line: [" << line << "]\n";
+      glm::ivec3 c = scaled;
+      auto [it, inserted] = cell_head.try_emplace(c, i);
+      if (!inserted) {
+        next_in_cell[i] = it->second;
+        it->second = i;
       }
     }
-    file.close();
-    this->particle_reset = this->particles;
-    create_particle_vertex_map();
-    return;
-  }
 
-  void create_particle_vertex_map() {
-    const float epsilon = 0.0f;
-    for (int i = 0; i < particles.size(); i++) {
-      for (int j = 0; j < vertices.size(); j++) {
-        if (glm::length(particles[i].pos - vertices[j].Position) <= epsilon) {
-          this->particle_vertex_map[i].push_back(j);
+    int unmatched = 0;
+    for (size_t j = 0; j < vertices.size(); j++) {
+      const glm::vec3 &pos = vertices[j].Position;
+      glm::vec3 scaled = pos / cell;
+      if (!cellInRange(glm::floor(scaled))) {
+        unmatched++;
+        continue;
+      }
+      glm::ivec3 c = glm::floor(scaled);
+      // step towards the nearer neighbour on each axis
+      glm::ivec3 side;
+      for (int a = 0; a < 3; a++)
+        side[a] = scaled[a] - c[a] < 0.5f ? -1 : 1;
+      int best = -1;
+      float best_dist = weld_tolerance;
+      for (int k = 0; k < 8; k++) {
+        glm::ivec3 probe = c + side * glm::ivec3(k & 1, (k >> 1) & 1, k >> 2);
+        auto it = cell_head.find(probe);
+        if (it == cell_head.end())
+          continue;
+        for (int i = it->second; i != -1; i = next_in_cell[i]) {
+          float dist = glm::length(particles[i].pos - pos);
+          // ties go to the lowest particle id
+          if (dist < best_dist ||
+              (dist == best_dist && (best == -1 || i < best))) {
+            best = i;
+            best_dist = dist;
+          }
         }
       }
+      if (best == -1)
+        unmatched++;
+      vertex_particle[j] = best;
     }
+    if (unmatched > 0)
+      std::cerr << "WARNING::MESH::UNWELDED_VERTICES " << unmatched << " of "
+                << vertices.size() << " vertices have no particle within "
+                << weld_tolerance << "\n";
   }
 
-  void addTetraIDs(const string &path) {
-    fstream f(path);
-    std::string line_buffer;
+  // Builds the render surface from the TetGen boundary faces, see
+  // buildSurface(). Returns false if the file can't be read.
+  bool addSurfaceTetGen(const std::string &path) {
+    vector<glm::ivec3> faces;
+    if (!loadTetGenFaces(path, faces))
+      return false;
+    buildSurface(faces);
+    return true;
+  }
 
-    regex reg("\\s+");
+  // Makes the particles the render vertices, so vertex j is driven by
+  // particle j and no welding is needed, and the 0-based boundary faces the
+  // triangles. Each face is wound to point away from the tet it belongs to.
+  // Interior particles become vertices no triangle references.
+  void buildSurface(const vector<glm::ivec3> &faces) {
+    int n = particles.size();
+    auto sorted = [](glm::ivec3 t) {
+      if (t.x > t.y)
+        std::swap(t.x, t.y);
+      if (t.y > t.z)
+        std::swap(t.y, t.z);
+      if (t.x > t.y)
+        std::swap(t.x, t.y);
+      return t;
+    };
+    auto validFace = [n](const glm::ivec3 &t) {
+      return t.x >= 0 && t.y >= 0 && t.z >= 0 && t.x < n && t.y < n &&
+             t.z < n;
+    };
+    // boundary faces bucketed by their smallest id (CSR), so a tet face only
+    // has to be compared with the one or two faces sharing that particle
+    vector<int> first_face(n + 1, 0);
+    vector<glm::ivec3> keys(faces.size());
+    for (size_t f = 0; f < faces.size(); f++) {
+      keys[f] = sorted(faces[f]);
+      if (validFace(faces[f]))
+        first_face[keys[f].x + 1]++;
+    }
+    for (int i = 0; i < n; i++)
+      first_face[i + 1] += first_face[i];
+    vector<int> bucket(first_face[n]);
+    vector<int> fill(first_face.begin(), first_face.end() - 1);
+    for (size_t f = 0; f < faces.size(); f++) {
+      if (validFace(faces[f]))
+        bucket[fill[keys[f].x]++] = f;
+    }
 
-    glm::vec4 tet;
+    // the tet vertex opposite each boundary face, -1 if no tet has it
+    vector<int> opposite(faces.size(), -1);
+    for (const Tetrahedron &tet : tetrahedrons) {
+      glm::ivec4 ids = glm::ivec4(tet.particle_ids);
+      for (int k = 0; k < 4; k++) {
+        glm::ivec3 key = sorted(glm::ivec3(
+            ids[(k + 1) % 4], ids[(k + 2) % 4], ids[(k + 3) % 4]));
+        for (int b = first_face[key.x]; b < first_face[key.x + 1]; b++) {
+          if (keys[bucket[b]] == key)
+            opposite[bucket[b]] = ids[k];
+        }
+      }
+    }
 
-    while (getline(f, line_buffer)) {
-      sregex_token_iterator iter(line_buffer.begin(), line_buffer.end(), reg,
-                                 -1);
-      sregex_token_iterator end;
+    vertices.assign(n, Vertex());
+    vertex_particle.resize(n);
+    for (int i = 0; i < n; i++) {
+      vertices[i].Position = particles[i].pos;
+      vertex_particle[i] = i;
+    }
+    indices.clear();
+    indices.reserve(faces.size() * 3);
+    int skipped = 0;
+    for (size_t f = 0; f < faces.size(); f++) {
+      glm::ivec3 t = faces[f];
+      if (!validFace(t)) {
+        skipped++;
+        continue;
+      }
+      if (opposite[f] >= 0) {
+        glm::vec3 a = particles[t.x].pos;
+        glm::vec3 normal = glm::cross(particles[t.y].pos - a,
+                                      particles[t.z].pos - a);
+        if (glm::dot(normal, particles[opposite[f]].pos - a) > 0)
+          std::swap(t.y, t.z);
+      }
+      indices.push_back(t.x);
+      indices.push_back(t.y);
+      indices.push_back(t.z);
+    }
+    if (skipped > 0)
+      std::cerr << "Skipping " << skipped
+                << " faces with invalid particle ids\n";
+    computeNormals();
+  }
 
-      vector<string> vec(iter, end);
+  // Area weighted vertex normals from the current triangle positions.
+  void computeNormals() {
+    normal_positions.clear(); // everything counts as moved
+    updateNormals();
+  }
 
-      Tetrahedron tet;
-      tet.particle_ids.x = std::stoi(vec[0]);
-      tet.particle_ids.y = std::stoi(vec[1]);
-      tet.particle_ids.z = std::stoi(vec[2]);
-      tet.particle_ids.w = std::stoi(vec[3]);
-      tet.rest_volume = getTetVolume(tet.particle_ids);
+  // Recomputes the normals around vertices that moved more than
+  // normal_tolerance since their normals were last computed. Face normals
+  // are cached, so a vertex normal only sums its faces from the vertex->face
+  // adjacency. Each pass splits its elements across the pool, if given.
+  void updateNormals(ThreadPool *pool = nullptr) {
+    const size_t MIN_CHUNK = 1 << 12;
+    auto forChunks = [&](size_t count,
+                         const std::function<void(size_t, size_t)> &fn) {
+      if (pool != nullptr)
+        pool->parallel_for(
+            count, [&](size_t b, size_t e, unsigned) { fn(b, e); },
+            MIN_CHUNK);
+      else
+        fn(0, count);
+    };
+    size_t n_faces = indices.size() / 3;
+    if (vertex_face_start.size() != vertices.size() + 1 ||
+        face_normals.size() != n_faces)
+      buildNormalAdjacency();
+    if (normal_positions.size() != vertices.size()) {
+      // first call: force every vertex to count as moved
+      normal_positions.assign(vertices.size(),
+                              glm::vec3(std::numeric_limits<float>::max()));
+    }
 
-      particles[tet.particle_ids.x].inv_mass = 1 / (tet.rest_volume / 4);
-      particles[tet.particle_ids.y].inv_mass = 1 / (tet.rest_volume / 4);
-      particles[tet.particle_ids.z].inv_mass = 1 / (tet.rest_volume / 4);
-      particles[tet.particle_ids.w].inv_mass = 1 / (tet.rest_volume / 4);
+    float tolerance2 = normal_tolerance * normal_tolerance;
+    forChunks(vertices.size(), [&](size_t begin, size_t end) {
+      for (size_t j = begin; j < end; j++) {
+        glm::vec3 d = vertices[j].Position - normal_positions[j];
+        vertex_moved[j] = glm::dot(d, d) > tolerance2;
+        if (vertex_moved[j])
+          normal_positions[j] = vertices[j].Position;
+      }
+    });
+    std::atomic<size_t> dirty_faces{0};
+    forChunks(n_faces, [&](size_t begin, size_t end) {
+      size_t dirty = 0;
+      for (size_t f = begin; f < end; f++) {
+        unsigned int a = indices[3 * f], b = indices[3 * f + 1],
+                     c = indices[3 * f + 2];
+        face_dirty[f] = vertex_moved[a] | vertex_moved[b] | vertex_moved[c];
+        if (!face_dirty[f])
+          continue;
+        dirty++;
+        // the cross product's length is twice the area
+        const glm::vec3 &pa = vertices[a].Position;
+        face_normals[f] = glm::cross(vertices[b].Position - pa,
+                                     vertices[c].Position - pa);
+      }
+      dirty_faces += dirty;
+    });
+    if (dirty_faces == 0)
+      return;
+    // when everything moved there is no need to look for dirty faces
+    bool all_dirty = dirty_faces == n_faces;
+    forChunks(vertices.size(), [&](size_t begin, size_t end) {
+      for (size_t j = begin; j < end; j++) {
+        int first = vertex_face_start[j], last = vertex_face_start[j + 1];
+        bool dirty = all_dirty;
+        for (int k = first; k < last && !dirty; k++)
+          dirty = face_dirty[vertex_faces[k]];
+        if (!dirty || first == last)
+          continue;
+        glm::vec3 normal(0.0f);
+        for (int k = first; k < last; k++)
+          normal += face_normals[vertex_faces[k]];
+        float len = glm::length(normal);
+        vertices[j].Normal = len > 0 ? normal / len : normal;
+      }
+    });
+  }
 
-      particles[tet.particle_ids.x].mass =
-          particles[tet.particle_ids.x].inv_mass;
-      particles[tet.particle_ids.y].mass =
-          particles[tet.particle_ids.y].inv_mass;
-      particles[tet.particle_ids.z].mass =
-          particles[tet.particle_ids.z].inv_mass;
-      particles[tet.particle_ids.w].mass =
-          particles[tet.particle_ids.w].inv_mass;
+  // Links every vertex to the faces using it, in face order (CSR).
+  void buildNormalAdjacency() {
+    size_t n_faces = indices.size() / 3;
+    vertex_face_start.assign(vertices.size() + 1, 0);
+    for (size_t i = 0; i < n_faces * 3; i++)
+      vertex_face_start[indices[i] + 1]++;
+    for (size_t j = 0; j < vertices.size(); j++)
+      vertex_face_start[j + 1] += vertex_face_start[j];
+    vertex_faces.resize(vertex_face_start.back());
+    vector<int> fill(vertex_face_start.begin(), vertex_face_start.end() - 1);
+    for (size_t i = 0; i < n_faces * 3; i++)
+      vertex_faces[fill[indices[i]]++] = i / 3;
+    face_normals.assign(n_faces, glm::vec3(0.0f));
+    face_dirty.assign(n_faces, 0);
+    vertex_moved.assign(vertices.size(), 0);
+    normal_positions.clear();
+  }
 
-      this->tetrahedrons.push_back(tet);
-    }
-    f.close();
+  // Legacy 0-based "n0 n1 n2 n3" tet list, see loadLegacyElements()
+  void addTetraIDs(const string &path) {
+    vector<glm::ivec4> tets;
+    if (!loadLegacyElements(path, tets))
+      std::cerr << "ERROR::MESH::CANNOT_READ " << path << "\n";
+    addTetrahedronList(tets);
   }
 
-  void addTetraIDsTetGen(const std::string &path) {
-    std::ifstream file(path);
-    std::string line;
-    std::regex whitespace("\\s+");
+  void addTetraIDsTetGen(const std::string &path,
+                         ThreadPool *pool = nullptr) {
+    vector<glm::ivec4> tets;
+    bool loaded = pool ? loadTetGenElements(path, tets, *pool)
+                       : loadTetGenElements(path, tets);
+    if (!loaded)
+      std::cerr << "ERROR::MESH::CANNOT_READ " << path << "\n";
+    addTetrahedronList(tets, pool);
+  }
 
-    while (std::getline(file, line)) {
-      // Trim leading/trailing spaces
-      line = std::regex_replace(line, std::regex("^\\s+|\\s+$"), "");
+  bool validTet(const glm::ivec4 &t) const {
+    int n = particles.size();
+    return t.x >= 0 && t.y >= 0 && t.z >= 0 && t.w >= 0 && t.x < n &&
+           t.y < n && t.z < n && t.w < n;
+  }
 
-      // Skip empty lines or comments
-      if (line.empty() || line[0] == '#')
+  void addTetrahedronList(const vector<glm::ivec4> &tets,
+                          ThreadPool *pool = nullptr) {
+    if (pool != nullptr && pool->size() > 1) {
+      addTetrahedronListParallel(tets, *pool);
+      return;
+    }
+    this->tetrahedrons.reserve(this->tetrahedrons.size() + tets.size());
+    for (const glm::ivec4 &t : tets) {
+      if (!validTet(t)) {
+        std::cerr << "Skipping tet with invalid particle id\n";
         continue;
+      }
+      addTetrahedron(glm::vec4(t));
+    }
+  }
 
-      std::sregex_token_iterator iter(line.begin(), line.end(), whitespace, -1);
-      std::sregex_token_iterator end;
-      std::vector<std::string> tokens(iter, end);
-
-      if (tokens.size() < 5) {
+  // Parallel addTetrahedronList(). Rest volumes are computed in chunks and
+  // each particle remembers the last tet that touches it, so the masses come
+  // out exactly as if the tets had been added one by one.
+  void addTetrahedronListParallel(const vector<glm::ivec4> &tets,
+                                  ThreadPool &pool) {
+    const size_t MIN_CHUNK = 1 << 14;
+    vector<float> volumes(tets.size());
+    vector<char> valid(tets.size());
+    // index + 1 of the last valid tet per particle, 0 if none
+    vector<std::atomic<size_t>> last_tet(particles.size());
+    for (std::atomic<size_t> &l : last_tet)
+      l.store(0, std::memory_order_relaxed);
+
+    pool.parallel_for(
+        tets.size(),
+        [&](size_t begin, size_t end, unsigned) {
+          for (size_t i = begin; i < end; i++) {
+            valid[i] = validTet(tets[i]);
+            if (!valid[i])
+              continue;
+            volumes[i] = getTetVolume(glm::vec4(tets[i]));
+            for (int j = 0; j < 4; j++) {
+              std::atomic<size_t> &l = last_tet[tets[i][j]];
+              size_t seen = l.load(std::memory_order_relaxed);
+              while (seen < i + 1 &&
+                     !l.compare_exchange_weak(seen, i + 1,
+                                              std::memory_order_relaxed))
+                ;
+            }
+          }
+        },
+        MIN_CHUNK);
+
+    this->tetrahedrons.reserve(this->tetrahedrons.size() + tets.size());
+    for (size_t i = 0; i < tets.size(); i++) {
+      if (!valid[i]) {
+        std::cerr << "Skipping tet with invalid particle id\n";
         continue;
       }
+      this->tetrahedrons.push_back({glm::vec4(tets[i]), volumes[i]});
+    }
 
-      try {
-        Tetrahedron tet;
-        // Adjusting for 1-based indices
-        tet.particle_ids.x = std::stoi(tokens[1]) - 1;
-        tet.particle_ids.y = std::stoi(tokens[2]) - 1;
-        tet.particle_ids.z = std::stoi(tokens[3]) - 1;
-        tet.particle_ids.w = std::stoi(tokens[4]) - 1;
-
-        tet.rest_volume = getTetVolume(tet.particle_ids);
-
-        particles[tet.particle_ids.x].inv_mass = 1 / (tet.rest_volume / 4);
-        particles[tet.particle_ids.y].inv_mass = 1 / (tet.rest_volume / 4);
-        particles[tet.particle_ids.z].inv_mass = 1 / (tet.rest_volume / 4);
-        particles[tet.particle_ids.w].inv_mass = 1 / (tet.rest_volume / 4);
-
-        particles[tet.particle_ids.x].mass =
-            particles[tet.particle_ids.x].inv_mass;
-        particles[tet.particle_ids.y].mass =
-            particles[tet.particle_ids.y].inv_mass;
-        particles[tet.particle_ids.z].mass =
-            particles[tet.particle_ids.z].inv_mass;
-        particles[tet.particle_ids.w].mass =
-            particles[tet.particle_ids.w].inv_mass;
-
-        tetrahedrons.push_back(tet);
-      } catch (const std::exception &e) {
-        std::cerr << "Exception parsing line: [" << line << "]\n"
-                  << "Error: " << e.what() << "\n";
-      }
+    pool.parallel_for(
+        particles.size(),
+        [&](size_t begin, size_t end, unsigned) {
+          for (size_t p = begin; p < end; p++) {
+            size_t l = last_tet[p].load(std::memory_order_relaxed);
+            if (l == 0)
+              continue;
+            particles[p].inv_mass = 1 / (volumes[l - 1] / 4);
+            particles[p].mass = particles[p].inv_mass;
+          }
+        },
+        MIN_CHUNK);
+  }
+
+  // Stores a tet with its rest volume and gives its particles the tet's
+  // lumped mass.
+  void addTetrahedron(const glm::vec4 &particle_ids) {
+    Tetrahedron tet;
+    tet.particle_ids = particle_ids;
+    tet.rest_volume = getTetVolume(tet.particle_ids);
+
+    for (int j = 0; j < 4; j++) {
+      Particle &p = particles[tet.particle_ids[j]];
+      p.inv_mass = 1 / (tet.rest_volume / 4);
+      p.mass = p.inv_mass;
     }
 
-    file.close();
+    this->tetrahedrons.push_back(tet);
   }
 
-  float getTetVolume(const glm::vec4 &t) {
-    Particle &point0 = particles[t.x];
-    Particle &point1 = particles[t.y];
-    Particle &point2 = particles[t.z];
-    Particle &point3 = particles[t.w];
+  float getTetVolume(const glm::vec4 &t) const {
+    const Particle &point0 = particles[t.x];
+    const Particle &point1 = particles[t.y];
+    const Particle &point2 = particles[t.z];
+    const Particle &point3 = particles[t.w];
 
     glm::vec3 tempVec1 = point1.pos - point0.pos;
     glm::vec3 tempVec2 = point2.pos - point0.pos;
@@ -347,6 +706,7 @@ public:
   }
 
   void pre_solve(float dt, glm::vec3 gravity) {
+    PROFILE_ZONE("pre_solve");
     for (int i = 0; i < particles.size(); i++) {
       if (particles[i].inv_mass == 0)
         continue;
@@ -361,7 +721,12 @@ public:
   }
 
   void post_solve(float dt) {
+    PROFILE_ZONE("post_solve");
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(-std::numeric_limits<float>::max());
     for (Particle &v : particles) {
+      lo = glm::min(lo, v.pos);
+      hi = glm::max(hi, v.pos);
       if (1.0 / dt >= INFINITY)
         continue;
       v.velocity =
@@ -370,9 +735,14 @@ public:
         v.velocity = {0, 0, 0};
       }
     }
+    if (!particles.empty()) {
+      bounds_min = lo;
+      bounds_max = hi;
+    }
   }
 
   void solve_edges(float dt) {
+    PROFILE_ZONE("solve_edges");
     double alpha = this->edge_compliance / dt / dt;
 
     for (Edge &e : this->edges) {
@@ -394,6 +764,7 @@ public:
   }
 
   void solve_volume(float dt) {
+    PROFILE_ZONE("solve_volume");
     double alpha = this->volume_compliance / dt / dt;
 
     std::vector<glm::vec3> volIdOrder = {glm::vec3(1, 3, 2), glm::vec3(0, 2, 3),
@@ -435,54 +806,77 @@ public:
     solve_volume(dt);
   }
 
-  void update(float dt, int substeps, glm::vec3 gravity) {
-    float sdt = dt / substeps;
-    for (int i = 0; i < substeps; i++) {
-      pre_solve(sdt, gravity);
-      solve(sdt);
-      post_solve(sdt);
+  // The pool, if given, is used for the normal update.
+  void update(float dt, int substeps, glm::vec3 gravity,
+              ThreadPool *pool = nullptr) {
+    PROFILE_ZONE("Mesh::update");
+    {
+      PROFILE_PHASE("substeps", PHASE_SIM);
+      float sdt = dt / substeps;
+      for (int i = 0; i < substeps; i++) {
+        pre_solve(sdt, gravity);
+        solve(sdt);
+        post_solve(sdt);
+      }
     }
-    update_vertices();
+    Profiler::get().addSolved(substeps,
+                              uint64_t(substeps) *
+                                  (edges.size() + tetrahedrons.size()));
+    update_vertices(pool);
   }
 
   void reset() { this->particles = this->particle_reset; }
 
-  void Draw(Shader &shader) {
-    unsigned int diffuseNr = 1;
-    unsigned int specularNr = 1;
-    unsigned int normalNr = 1;
-    unsigned int heightNr = 1;
-    for (unsigned int i = 0; i < textures.size(); i++) {
-      glActiveTexture(GL_TEXTURE0 + i);
-      string number;
-      string name = textures[i].type;
-      if (name == "texture_diffuse") {
-        number = std::to_string(diffuseNr++);
-        shader.setInt("material.diffuse", i);
-      } else if (name == "texture_specular") {
-        number = std::to_string(specularNr++);
-        shader.setInt("material.specular", i);
-      } else if (name == "texture_normal") {
-        number = std::to_string(normalNr++);
-        shader.setInt("material.normal", i);
-      } else if (name == "texture_height") {
-        number = std::to_string(heightNr++);
-        shader.setInt("material.height", i);
-      }
-      shader.setFloat("material.shininess", 32.0f);
+  // Drops the compiled materials, after textures changed.
+  void invalidateMaterial() { material_tables.clear(); }
 
-      glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-      glBindTexture(GL_TEXTURE_2D, textures[i].id);
+  // Recomputes the bounds from the render vertices.
+  void computeBounds() {
+    if (vertices.empty()) {
+      bounds_min = bounds_max = glm::vec3(0.0f);
+      return;
+    }
+    bounds_min = bounds_max = vertices[0].Position;
+    for (const Vertex &v : vertices) {
+      bounds_min = glm::min(bounds_min, v.Position);
+      bounds_max = glm::max(bounds_max, v.Position);
     }
+  }
 
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()),
-                   GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+  // Sphere around the bounding box.
+  glm::vec3 boundsCenter() const { return 0.5f * (bounds_min + bounds_max); }
+  float boundsRadius() const {
+    return 0.5f * glm::length(bounds_max - bounds_min);
+  }
 
+  void Draw(Shader &shader) {
+    GLStateCache state;
+    Draw(shader, state);
+    glBindVertexArray(0);
     glActiveTexture(GL_TEXTURE0);
   }
 
+  // Binds through the cache, so textures and the VAO that are already bound
+  // from the previous draw are skipped. Leaves them bound. More than one
+  // instance draws instanced; the caller sets up the instance attributes.
+  // The shader's program must be current.
+  void Draw(Shader &shader, GLStateCache &state, GLsizei instances = 1) {
+    for (const MaterialBinding &binding : materialBindings(shader)) {
+      state.bindTexture(binding.unit, binding.texture);
+      state.setSampler(binding.location, binding.unit);
+    }
+
+    state.bindVertexArray(VAO);
+    if (instances > 1)
+      glDrawElementsInstanced(GL_TRIANGLES,
+                              static_cast<unsigned int>(indices.size()),
+                              GL_UNSIGNED_INT, 0, instances);
+    else
+      glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()),
+                     GL_UNSIGNED_INT, 0);
+    state.countDraw(instances);
+  }
+
   /// Ray-triangle intersection test
   bool triangle_intersect(const Ray &ray, Hit &hit, float tmin, glm::vec3 a,
                           glm::vec3 b, glm::vec3 c) {
@@ -533,53 +927,199 @@ public:
     return result;
   }
 
+  // Copies particle positions onto the render vertices they drive. Meshes
+  // that are drawn also get their normals updated and streamed, unless they
+  // are out of view.
+  void update_vertices(ThreadPool *pool = nullptr) {
+    {
+      PROFILE_PHASE("update_vertices", PHASE_VERTEX_UPDATE);
+      for (size_t j = 0; j < vertex_particle.size(); j++) {
+        int i = vertex_particle[j];
+        if (i >= 0)
+          vertices[j].Position = particles[i].pos;
+      }
+    }
+    if (is_headless)
+      return;
+    if (!in_view) {
+      gpu_stale = true;
+      return;
+    }
+    gpu_stale = false;
+    {
+      PROFILE_PHASE("normals", PHASE_VERTEX_UPDATE);
+      updateNormals(pool);
+    }
+    PROFILE_PHASE("upload", PHASE_UPLOAD);
+    streamVertices();
+  }
+
+  // Catches up on the normals and the upload skipped while the mesh was out
+  // of view. The render queue calls it before drawing the mesh again.
+  void syncVertices() {
+    if (!gpu_stale || is_headless)
+      return;
+    gpu_stale = false;
+    updateNormals();
+    streamVertices();
+  }
+
+  // Uploads the current dynamic attributes. The first call on a mesh that
+  // was laid out interleaved (it became soft after the upload) splits its
+  // streams; every call then orphans the dynamic buffer and refills it, so
+  // the driver never stalls on a frame that is still drawing and the static
+  // attributes are never touched again. (Persistent mapping would need
+  // GL 4.4 or ARB_buffer_storage, but the baseline is GL 3.3.)
+  void streamVertices() {
+    if (VAO == 0 || vertices.empty())
+      return;
+    if (dynamic_stream.buffer == 0) {
+      setupBuffers(true);
+      return;
+    }
+    const void *data = dynamic_stream.pack(vertices);
+    size_t bytes = vertices.size() * dynamic_stream.stride;
+    glBindBuffer(GL_ARRAY_BUFFER, dynamic_stream.buffer);
+    glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data);
+  }
+
 private:
-  unsigned int VBO, EBO;
+  struct MaterialTable {
+    GLuint program;
+    vector<MaterialBinding> bindings;
+  };
+
+  unsigned int EBO = 0;
+  // compiled materials by program, usually just one
+  vector<MaterialTable> material_tables;
+  // the GPU vertices lag behind because update_vertices() ran while the
+  // mesh was out of view
+  bool gpu_stale = false;
+  VertexStream static_stream, dynamic_stream;
+
+  // Whether a floored, scaled position converts to a hash grid cell without
+  // overflow, with room for the neighbour probes. False for NaN.
+  static bool cellInRange(const glm::vec3 &floored) {
+    const float limit = 1 << 30;
+    for (int a = 0; a < 3; a++)
+      if (!(floored[a] >= -limit && floored[a] <= limit))
+        return false;
+    return true;
+  }
 
-  void setupMesh() {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+  // updateNormals() state: vertex->face CSR, cached area weighted face
+  // normals and the positions the current normals were computed from
+  vector<int> vertex_face_start;
+  vector<int> vertex_faces;
+  vector<glm::vec3> face_normals;
+  vector<glm::vec3> normal_positions;
+  vector<char> vertex_moved;
+  vector<char> face_dirty;
+
+  const vector<MaterialBinding> &materialBindings(Shader &shader) {
+    for (const MaterialTable &table : material_tables)
+      if (table.program == shader.ID)
+        return table.bindings;
+    material_tables.push_back({shader.ID, compileMaterial(shader)});
+    return material_tables.back().bindings;
+  }
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                 &vertices[0], GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 &indices[0], GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, Normal));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, TexCoords));
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, Tangent));
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, Bitangent));
-    glEnableVertexAttribArray(5);
-    glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex),
-                           (void *)offsetof(Vertex, m_BoneIDs));
-    glEnableVertexAttribArray(6);
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, m_Weights));
-    glBindVertexArray(0);
+  // Resolves the textures against the program's samplers, both the
+  // material.<role> struct members and the legacy <type><n> names. Textures
+  // the program doesn't sample are left out. Also sets the shininess, which
+  // is the same for every material.
+  vector<MaterialBinding> compileMaterial(Shader &shader) {
+    const size_t roles = std::size(MATERIAL_TEXTURE_TYPES);
+    vector<int> role(textures.size(), -1);
+    int total[roles] = {};
+    for (size_t i = 0; i < textures.size(); i++) {
+      auto type = std::find(std::begin(MATERIAL_TEXTURE_TYPES),
+                            std::end(MATERIAL_TEXTURE_TYPES), textures[i].type);
+      if (type == std::end(MATERIAL_TEXTURE_TYPES))
+        continue;
+      role[i] = type - std::begin(MATERIAL_TEXTURE_TYPES);
+      total[role[i]]++;
+    }
+
+    vector<MaterialBinding> bindings;
+    int count[roles] = {};
+    for (size_t i = 0; i < textures.size(); i++) {
+      if (role[i] < 0)
+        continue;
+      int n = ++count[role[i]];
+      GLuint unit = role[i] + roles * (n - 1);
+      if (unit >= MATERIAL_TEXTURE_UNITS)
+        continue;
+      GLint numbered =
+          shader.uniformLocation(textures[i].type + std::to_string(n));
+      if (numbered >= 0)
+        bindings.push_back({unit, textures[i].id, numbered});
+      // material.<role> samples the last texture of its type, as it did
+      // when the samplers were set texture by texture
+      GLint member = shader.uniformLocation(MATERIAL_SAMPLERS[role[i]]);
+      if (member >= 0 && n == total[role[i]])
+        bindings.push_back({unit, textures[i].id, member});
+    }
+    shader.setFloat("material.shininess", 32.0f);
+    return bindings;
   }
 
-  void update_vertices() {
-    for (int i = 0; i < particles.size(); i++) {
-      for (auto &j : particle_vertex_map[i]) {
-        vertices[j].Position = particles[i].pos;
-      }
+  void setupMesh() {
+    computeBounds();
+    setupBuffers(is_soft);
+  }
+
+  // (Re)builds the vertex buffers and the VAO from VERTEX_LAYOUT, with the
+  // dynamic attributes in their own stream when split is set.
+  void setupBuffers(bool split) {
+    if (VAO == 0) {
+      glGenVertexArrays(1, &VAO);
+      glGenBuffers(1, &EBO);
+      glBindVertexArray(VAO);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                   indices.size() * sizeof(unsigned int), indices.data(),
+                   GL_STATIC_DRAW);
     }
-    setupMesh();
+    glBindVertexArray(VAO);
+    static_stream.clear();
+    dynamic_stream.clear();
+
+    size_t packed_offset[std::size(VERTEX_LAYOUT)];
+    for (size_t i = 0; i < std::size(VERTEX_LAYOUT); i++) {
+      const VertexAttribute &a = VERTEX_LAYOUT[i];
+      VertexStream &stream =
+          split && a.dynamic ? dynamic_stream : static_stream;
+      packed_offset[i] = stream.add(a);
+    }
+    for (VertexStream *stream : {&static_stream, &dynamic_stream}) {
+      if (stream->stride == 0)
+        continue;
+      glGenBuffers(1, &stream->buffer);
+      glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+      glBufferData(GL_ARRAY_BUFFER, vertices.size() * stream->stride,
+                   stream->pack(vertices),
+                   stream == &dynamic_stream ? GL_STREAM_DRAW
+                                             : GL_STATIC_DRAW);
+    }
+    // the static data never changes again
+    static_stream.staging = {};
+
+    for (size_t i = 0; i < std::size(VERTEX_LAYOUT); i++) {
+      const VertexAttribute &a = VERTEX_LAYOUT[i];
+      const VertexStream &stream =
+          split && a.dynamic ? dynamic_stream : static_stream;
+      glBindBuffer(GL_ARRAY_BUFFER, stream.buffer);
+      glEnableVertexAttribArray(a.location);
+      if (a.type == GL_INT)
+        glVertexAttribIPointer(a.location, a.components, a.type, stream.stride,
+                               (void *)packed_offset[i]);
+      else
+        glVertexAttribPointer(a.location, a.components, a.type, GL_FALSE,
+                              stream.stride, (void *)packed_offset[i]);
+    }
+    glBindVertexArray(0);
   }
 };
 
@@ -5,28 +5,57 @@
 
 #include <glad/glad.h>
 
+#include <assimp/DefaultIOSystem.h>
 #include <assimp/Importer.hpp>
+#include <assimp/MemoryIOWrapper.h>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <stb_image.h>
 
+#include "AssetPack.h"
 #include "Mesh.h"
 #include "Ray.h"
+#include "RenderQueue.h"
 #include "Shader.h"
+#include "TextureCache.h"
 
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory,
                              bool gamma = false);
 
+// Lets Assimp read the model and its side files (.mtl) from the open asset
+// pack, falling back to the file system for anything the pack lacks.
+class PackIOSystem : public Assimp::DefaultIOSystem {
+public:
+  using Assimp::DefaultIOSystem::Open;
+
+  bool Exists(const char *pFile) const override {
+    std::string_view blob;
+    return AssetPack::get().view(pFile, blob) ||
+           Assimp::DefaultIOSystem::Exists(pFile);
+  }
+
+  Assimp::IOStream *Open(const char *pFile,
+                         const char *pMode = "rb") override {
+    std::string_view blob;
+    if (pMode[0] == 'r' && AssetPack::get().view(pFile, blob))
+      return new Assimp::MemoryIOStream(
+          reinterpret_cast<const uint8_t *>(blob.data()), blob.size());
+    return Assimp::DefaultIOSystem::Open(pFile, pMode);
+  }
+};
+
 class Model {
 public:
   vector<Texture> textures_loaded;
@@ -34,18 +63,99 @@ public:
   string directory;
   bool gammaCorrection;
 
-  Model(string const &path, bool gamma = false) : gammaCorrection(gamma) {
+  // With defer_upload the constructor does no GL work, so it can run on a
+  // loader thread: meshes are built headless and textures are only decoded.
+  // uploadStep() then finishes the load on the GL thread.
+  Model(string const &path, bool gamma = false, bool defer_upload = false)
+      : gammaCorrection(gamma), deferred(defer_upload) {
     loadModel(path);
+    // the decodes ran in parallel with the rest of the import
+    for (PendingTexture &pending : pending_textures)
+      pending.image = pending.decoding.get();
   }
 
+  // Wraps meshes that were built in code rather than imported. With
+  // defer_upload they must be headless and are uploaded by uploadStep().
+  explicit Model(vector<Mesh> meshes, bool defer_upload = false)
+      : meshes(std::move(meshes)), gammaCorrection(false),
+        deferred(defer_upload) {}
+
   void Draw(Shader &shader) {
     for (unsigned int i = 0; i < meshes.size(); i++)
       meshes[i].Draw(shader);
   }
 
+  // Queues every mesh with the model matrix.
+  void Submit(RenderQueue &queue, Shader &shader, const glm::mat4 &model) {
+    uint32_t transform = queue.addTransform(model);
+    for (Mesh &mesh : meshes)
+      queue.submit(shader, mesh, transform);
+  }
+
+  bool uploaded() const { return upload_cursor >= uploadSteps(); }
+
+  // Does the next piece of a deferred upload, one texture or one mesh, so
+  // callers can spread the work over several frames. Returns true once the
+  // model is fully on the GPU.
+  bool uploadStep() {
+    if (uploaded())
+      return true;
+    if (upload_cursor < pending_textures.size()) {
+      PendingTexture &pending = pending_textures[upload_cursor];
+      textures_loaded[pending.loaded_index].id =
+          TextureCache::get().acquire(pending.image);
+      pending.image = TextureImage();
+      pending.decoding = {};
+      if (++upload_cursor == pending_textures.size())
+        patchTextureIds();
+    } else {
+      meshes[upload_cursor - pending_textures.size()].upload();
+      upload_cursor++;
+    }
+    return uploaded();
+  }
+
+  // Drops this model's references in the TextureCache. GL thread only.
+  void releaseTextures() {
+    for (Texture &texture : textures_loaded) {
+      if (texture.id != 0)
+        TextureCache::get().release(texture.id);
+      texture.id = 0;
+    }
+  }
+
 private:
+  struct PendingTexture {
+    size_t loaded_index; // into textures_loaded
+    std::shared_future<TextureImage> decoding;
+    TextureImage image;
+  };
+
+  bool deferred;
+  // textures_loaded index by the path the material uses
+  unordered_map<string, size_t> loaded_by_path;
+  vector<PendingTexture> pending_textures;
+  size_t upload_cursor = 0;
+
+  size_t uploadSteps() const {
+    return deferred ? pending_textures.size() + meshes.size() : 0;
+  }
+
+  // Meshes copied their textures before the ids existed.
+  void patchTextureIds() {
+    for (Mesh &mesh : meshes) {
+      for (Texture &texture : mesh.textures)
+        for (const Texture &loaded : textures_loaded)
+          if (loaded.path == texture.path)
+            texture.id = loaded.id;
+      mesh.invalidateMaterial();
+    }
+  }
+
   void loadModel(string const &path) {
     Assimp::Importer importer;
+    if (AssetPack::get().isOpen())
+      importer.SetIOHandler(new PackIOSystem); // owned by the importer
     const aiScene *scene = importer.ReadFile(
         path, aiProcess_Triangulate | aiProcess_GenSmoothNormals |
                   aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
@@ -125,7 +235,7 @@ private:
         loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
     textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-    return Mesh(vertices, indices, textures);
+    return Mesh(vertices, indices, textures, deferred);
   }
 
   vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type,
@@ -134,22 +244,27 @@ private:
     for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
       aiString str;
       mat->GetTexture(type, i, &str);
-      bool skip = false;
-      for (unsigned int j = 0; j < textures_loaded.size(); j++) {
-        if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0) {
-          textures.push_back(textures_loaded[j]);
-          skip = true;
-          break;
-        }
+      auto loaded = loaded_by_path.find(str.C_Str());
+      if (loaded != loaded_by_path.end()) {
+        textures.push_back(textures_loaded[loaded->second]);
+        continue;
       }
-      if (!skip) {
-        Texture texture;
-        texture.id = TextureFromFile(str.C_Str(), this->directory);
-        texture.type = typeName;
-        texture.path = str.C_Str();
-        textures.push_back(texture);
-        textures_loaded.push_back(texture);
+      string filename = this->directory + '/' + str.C_Str();
+      Texture texture;
+      if (deferred) {
+        // decode only if no model has it resident yet
+        texture.id = TextureCache::get().acquireCached(filename);
+        if (texture.id == 0)
+          pending_textures.push_back(
+              {textures_loaded.size(), decodeTextureAsync(filename), {}});
+      } else {
+        texture.id = TextureCache::get().acquire(filename);
       }
+      texture.type = typeName;
+      texture.path = str.C_Str();
+      loaded_by_path[texture.path] = textures_loaded.size();
+      textures.push_back(texture);
+      textures_loaded.push_back(texture);
     }
     return textures;
   }
@@ -159,39 +274,6 @@ unsigned int TextureFromFile(const char *path, const string &directory,
                              bool gamma) {
   string filename = string(path);
   filename = directory + '/' + filename;
-
-  unsigned int textureID;
-  glGenTextures(1, &textureID);
-
-  int width, height, nrComponents;
-  unsigned char *data =
-      stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-  if (data) {
-    GLenum format;
-    if (nrComponents == 1)
-      format = GL_RED;
-    else if (nrComponents == 3)
-      format = GL_RGB;
-    else if (nrComponents == 4)
-      format = GL_RGBA;
-
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    stbi_image_free(data);
-  } else {
-    std::cout << "Texture failed to load at path: " << path << std::endl;
-    stbi_image_free(data);
-  }
-
-  return textureID;
+  return uploadTexture(decodeTexture(filename));
 }
 #endif
@@ -0,0 +1,142 @@
+#ifndef PERFOVERLAY_H
+#define PERFOVERLAY_H
+
+#include <imgui/headers/imgui.h>
+
+#include "GLState.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// ImGui "Performance" window: rolling frame time graph, per-phase history,
+// frame time percentiles and solver throughput, all fed by the Profiler's
+// phase counters, plus the draw and bind counts of the last frame.
+class PerfOverlay {
+public:
+  static const int HISTORY = 240;
+  bool visible = true;
+
+  // Closes the previous frame: takes the Profiler counters accumulated
+  // since the last call and appends them to the history. render holds the
+  // GLStateCache counters of the frame.
+  void endFrame(float frame_seconds, const RenderStats &render = {}) {
+    PerfCounters c = Profiler::get().takeCounters();
+    this->render = render;
+    frame_ms[offset] = frame_seconds * 1000.0f;
+    for (int p = 0; p < PHASE_COUNT; p++)
+      phase_ms[p][offset] = c.phase_ns[p] / 1e6f;
+    offset = (offset + 1) % HISTORY;
+    count = std::min(count + 1, HISTORY);
+
+    // throughput is averaged over roughly half a second so it stays readable
+    window_seconds += frame_seconds;
+    window_substeps += c.substeps;
+    for (auto &[name, n] : c.thread_constraints) {
+      auto it = std::find_if(window_constraints.begin(),
+                             window_constraints.end(),
+                             [&](const std::pair<std::string, double> &e) {
+                               return e.first == name;
+                             });
+      if (it == window_constraints.end())
+        window_constraints.push_back({name, double(n)});
+      else
+        it->second += n;
+    }
+    if (window_seconds >= 0.5f) {
+      substeps_per_second = window_substeps / window_seconds;
+      constraints_per_second = window_constraints;
+      for (auto &e : constraints_per_second)
+        e.second /= window_seconds;
+      window_seconds = 0;
+      window_substeps = 0;
+      window_constraints.clear();
+    }
+  }
+
+  void draw() {
+    if (!visible || count == 0)
+      return;
+
+    ImGui::SetNextWindowPos(ImVec2(0, 260), ImGuiCond_FirstUseEver);
+    ImGui::Begin("Performance", &visible, ImGuiWindowFlags_AlwaysAutoResize);
+
+    float sorted[HISTORY];
+    std::copy(frame_ms, frame_ms + count, sorted);
+    std::sort(sorted, sorted + count);
+    float latest = frame_ms[(offset + HISTORY - 1) % HISTORY];
+    ImGui::Text("frame %.2f ms (%.0f fps)", latest,
+                latest > 0 ? 1000.0f / latest : 0.0f);
+    ImGui::Text("p50 %.2f  p95 %.2f  p99 %.2f  max %.2f ms",
+                percentile(sorted, 0.50f), percentile(sorted, 0.95f),
+                percentile(sorted, 0.99f), sorted[count - 1]);
+    ImGui::PlotLines("##frame", frame_ms, HISTORY, offset, "frame ms", 0.0f,
+                     std::max(33.3f, sorted[count - 1]), ImVec2(320, 60));
+
+    if (ImGui::BeginTable("phases", 3)) {
+      ImGui::TableSetupColumn("phase");
+      ImGui::TableSetupColumn("ms");
+      ImGui::TableSetupColumn("history");
+      ImGui::TableHeadersRow();
+      for (int p = 0; p < PHASE_COUNT; p++) {
+        float mean = 0.0f;
+        float peak = 0.0f;
+        for (int i = 0; i < count; i++) {
+          mean += phase_ms[p][i];
+          peak = std::max(peak, phase_ms[p][i]);
+        }
+        mean /= count;
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(PERF_PHASE_NAMES[p]);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", mean);
+        ImGui::TableNextColumn();
+        ImGui::PushID(p);
+        ImGui::PlotHistogram("##phase", phase_ms[p], HISTORY, offset, nullptr,
+                             0.0f, std::max(peak, 0.001f), ImVec2(200, 24));
+        ImGui::PopID();
+      }
+      ImGui::EndTable();
+    }
+
+    ImGui::Text("substeps/s: %.0f", substeps_per_second);
+    for (auto &[name, rate] : constraints_per_second)
+      ImGui::Text("constraints/s (%s): %.3g", name.c_str(), rate);
+
+    ImGui::Text("draws: %llu (%llu objects, %llu culled)",
+                (unsigned long long)render.draws,
+                (unsigned long long)render.instances,
+                (unsigned long long)render.culled);
+    ImGui::Text("binds (skipped): program %llu (%llu)  vao %llu (%llu)  "
+                "texture %llu (%llu)",
+                (unsigned long long)render.program_binds,
+                (unsigned long long)render.program_binds_skipped,
+                (unsigned long long)render.vao_binds,
+                (unsigned long long)render.vao_binds_skipped,
+                (unsigned long long)render.texture_binds,
+                (unsigned long long)render.texture_binds_skipped);
+
+    ImGui::End();
+  }
+
+private:
+  float frame_ms[HISTORY] = {};
+  float phase_ms[PHASE_COUNT][HISTORY] = {};
+  int offset = 0;
+  int count = 0;
+
+  float window_seconds = 0;
+  double window_substeps = 0;
+  std::vector<std::pair<std::string, double>> window_constraints;
+  double substeps_per_second = 0;
+  std::vector<std::pair<std::string, double>> constraints_per_second;
+  RenderStats render;
+
+  float percentile(const float *sorted, float q) const {
+    return sorted[static_cast<int>(q * (count - 1) + 0.5f)];
+  }
+};
+
+#endif // !PERFOVERLAY_H
@@ -0,0 +1,50 @@
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "Hit.h"
+#include "Mesh.h"
+#include "Ray.h"
+
+#include <vector>
+
+// Ray picking against soft body surfaces, shared by the interactive app and
+// the benchmarks.
+
+Mesh *intersection(Camera &c, vector<Mesh> &meshes, Hit &h) {
+  Mesh *hitMesh = nullptr;
+  bool intersect = false;
+  Ray r(c.Position, c.Front);
+  for (Mesh &mesh : meshes) {
+    // buffer var to check when to update mesh
+    float t0 = h.getT();
+    mesh.intersect(r, h, 0.0f);
+    float t1 = h.getT();
+    // update hitMesh if t is updated
+    if (t1 < t0) {
+      hitMesh = &mesh;
+      intersect = true;
+    }
+  }
+  return hitMesh;
+}
+
+Particle *findPointRT(Camera &c, Hit &h, Mesh &hitMesh) {
+  float t = h.getT();
+  glm::vec3 intersection_point = c.Position + t * c.Front;
+  Particle *nearest_particle = &hitMesh.particles[0];
+  float min_distance = glm::length(intersection_point - nearest_particle->pos);
+
+  for (Particle &p : hitMesh.particles) {
+    float new_distance = glm::length(intersection_point - p.pos);
+    if (new_distance < min_distance) {
+      nearest_particle = &p;
+      min_distance = new_distance;
+    }
+  }
+  return nearest_particle;
+}
+
+#endif // !PICKING_H
@@ -0,0 +1,219 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped timing zones written to per-thread ring buffers and exported as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev). Recording is off by
+// default; a disabled zone costs one relaxed atomic load.
+//
+//   PROFILE_ZONE("solve_edges");
+//
+// PROFILE_PHASE additionally adds the zone's duration to one of the engine
+// phases below. Phase timers are always on and feed the performance overlay.
+//
+//   PROFILE_PHASE("Model::Draw", PHASE_DRAW);
+
+enum PerfPhase {
+  PHASE_SIM,
+  PHASE_VERTEX_UPDATE,
+  PHASE_UPLOAD,
+  PHASE_DRAW,
+  PHASE_PICKING,
+  PHASE_COUNT
+};
+
+const char *const PERF_PHASE_NAMES[PHASE_COUNT] = {
+    "sim", "vertex update", "upload", "draw", "picking"};
+
+// Counters accumulated since the last Profiler::takeCounters().
+struct PerfCounters {
+  uint64_t phase_ns[PHASE_COUNT] = {};
+  uint64_t substeps = 0;
+  // constraints solved, per thread that solved any
+  std::vector<std::pair<std::string, uint64_t>> thread_constraints;
+};
+
+struct TraceEvent {
+  const char *name; // must outlive the profiler, normally a string literal
+  uint64_t start_ns;
+  uint64_t dur_ns;
+};
+
+// Per-thread state. Events form a single producer ring buffer: only the
+// owning thread writes, readers take the events below the published head.
+// Oldest events are overwritten.
+class TraceBuffer {
+public:
+  static const uint64_t CAPACITY = 1 << 18;
+
+  explicit TraceBuffer(uint32_t tid)
+      : tid(tid), name("thread " + std::to_string(tid)) {}
+
+  void push(const TraceEvent &e) {
+    if (events.empty())
+      events.resize(CAPACITY);
+    uint64_t i = head.load(std::memory_order_relaxed);
+    events[i & (CAPACITY - 1)] = e;
+    head.store(i + 1, std::memory_order_release);
+  }
+
+  uint32_t tid;
+  std::string name; // shown as the track name in the trace viewer
+  std::vector<TraceEvent> events;
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> constraints{0};
+};
+
+class Profiler {
+public:
+  std::atomic<bool> enabled{false};
+
+  static Profiler &get() {
+    static Profiler instance;
+    return instance;
+  }
+
+  uint64_t now_ns() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - epoch)
+        .count();
+  }
+
+  TraceBuffer &thread_buffer() {
+    thread_local TraceBuffer *buffer = nullptr;
+    if (buffer == nullptr) {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+      buffers.push_back(std::make_unique<TraceBuffer>(buffers.size() + 1));
+      buffer = buffers.back().get();
+    }
+    return *buffer;
+  }
+
+  void setThreadName(const std::string &name) { thread_buffer().name = name; }
+
+  void addPhase(int phase, uint64_t ns) {
+    phase_ns[phase].fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  // Called once per Mesh::update with the work it just did.
+  void addSolved(uint64_t substeps, uint64_t constraints) {
+    substeps_solved.fetch_add(substeps, std::memory_order_relaxed);
+    thread_buffer().constraints.fetch_add(constraints,
+                                          std::memory_order_relaxed);
+  }
+
+  // Returns and resets the phase and solver counters.
+  PerfCounters takeCounters() {
+    PerfCounters c;
+    for (int i = 0; i < PHASE_COUNT; i++)
+      c.phase_ns[i] = phase_ns[i].exchange(0, std::memory_order_relaxed);
+    c.substeps = substeps_solved.exchange(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto &b : buffers) {
+      uint64_t n = b->constraints.exchange(0, std::memory_order_relaxed);
+      if (n > 0)
+        c.thread_constraints.push_back({b->name, n});
+    }
+    return c;
+  }
+
+  // Drops recorded events. Call while no zones are open on other threads.
+  void clear() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto &b : buffers)
+      b->head.store(0, std::memory_order_release);
+  }
+
+  // Writes every retained event as a complete ("X") event. Meant to be
+  // called between frames while worker threads are idle.
+  bool writeChromeTrace(const std::string &path) {
+    std::ofstream file(path);
+    if (!file) {
+      std::cerr << "ERROR::PROFILER::CANNOT_WRITE " << path << std::endl;
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    size_t count = 0;
+    for (auto &b : buffers) {
+      file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": "
+           << "\"M\", \"pid\": 1, \"tid\": " << b->tid
+           << ", \"args\": {\"name\": \"" << b->name << "\"}}";
+      first = false;
+      uint64_t head = b->head.load(std::memory_order_acquire);
+      uint64_t begin = head > TraceBuffer::CAPACITY
+                           ? head - TraceBuffer::CAPACITY
+                           : 0;
+      for (uint64_t i = begin; i < head; i++) {
+        const TraceEvent &e = b->events[i & (TraceBuffer::CAPACITY - 1)];
+        file << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", "
+             << "\"pid\": 1, \"tid\": " << b->tid
+             << ", \"ts\": " << e.start_ns / 1000.0
+             << ", \"dur\": " << e.dur_ns / 1000.0 << "}";
+        count++;
+      }
+    }
+    file << "\n]}\n";
+    std::cout << "Wrote " << count << " trace events to " << path
+              << std::endl;
+    return true;
+  }
+
+private:
+  std::chrono::steady_clock::time_point epoch =
+      std::chrono::steady_clock::now();
+  std::mutex registry_mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+  std::atomic<uint64_t> phase_ns[PHASE_COUNT] = {};
+  std::atomic<uint64_t> substeps_solved{0};
+};
+
+class ProfileZone {
+public:
+  explicit ProfileZone(const char *name, int phase = -1)
+      : name(name), phase(phase) {
+    Profiler &p = Profiler::get();
+    active = p.enabled.load(std::memory_order_relaxed);
+    if (active || phase >= 0)
+      start_ns = p.now_ns();
+  }
+
+  ~ProfileZone() {
+    if (!active && phase < 0)
+      return;
+    Profiler &p = Profiler::get();
+    uint64_t dur_ns = p.now_ns() - start_ns;
+    if (phase >= 0)
+      p.addPhase(phase, dur_ns);
+    if (active)
+      p.thread_buffer().push({name, start_ns, dur_ns});
+  }
+
+  ProfileZone(const ProfileZone &) = delete;
+  ProfileZone &operator=(const ProfileZone &) = delete;
+
+private:
+  const char *name;
+  int phase;
+  uint64_t start_ns = 0;
+  bool active;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name)                                                     \
+  ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_PHASE(name, phase)                                             \
+  ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name, phase)
+
+#endif // !PROFILER_H
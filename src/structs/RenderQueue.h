@@ -0,0 +1,328 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// A queued draw. The key packs, most significant first,
+//   program slot (8) | material slot (16) | VAO (16) | depth (24)
+// so sorting it runs draws that share a program back to back, then those
+// that share textures, then those that share vertex data, and front to
+// back within a group so early depth testing rejects hidden fragments.
+struct RenderItem {
+  uint64_t key;
+  uint32_t command;
+};
+
+// LSD radix sort on the key bytes, stable. The histograms of all bytes are
+// built in one pass, and passes over a byte that is the same in every key
+// are skipped. The fixed cost of the histograms only pays off for long
+// queues; shorter ones are sorted by comparison, with ties broken by
+// submission order so the result is the same.
+inline void radixSortRenderItems(std::vector<RenderItem> &items,
+                                 std::vector<RenderItem> &scratch) {
+  if (items.size() < 1024) {
+    std::sort(items.begin(), items.end(),
+              [](const RenderItem &a, const RenderItem &b) {
+                return a.key < b.key ||
+                       (a.key == b.key && a.command < b.command);
+              });
+    return;
+  }
+  uint32_t start[8][256] = {};
+  for (const RenderItem &item : items)
+    for (int byte = 0; byte < 8; byte++)
+      start[byte][(item.key >> (8 * byte)) & 0xff]++;
+  scratch.resize(items.size());
+  for (int byte = 0; byte < 8; byte++) {
+    int shift = 8 * byte;
+    if (start[byte][(items[0].key >> shift) & 0xff] == items.size())
+      continue;
+    uint32_t offset = 0;
+    for (uint32_t &bucket : start[byte]) {
+      uint32_t n = bucket;
+      bucket = offset;
+      offset += n;
+    }
+    for (const RenderItem &item : items)
+      scratch[start[byte][(item.key >> shift) & 0xff]++] = item;
+    items.swap(scratch);
+  }
+}
+
+// Non-negative floats order like their bit patterns, so the top bits of the
+// float quantize depth monotonically without needing a depth range.
+inline uint64_t depthKey(float depth) {
+  depth = std::max(depth, 0.0f);
+  uint32_t bits;
+  std::memcpy(&bits, &depth, sizeof(bits));
+  return bits >> 8;
+}
+
+// First of the four attribute locations holding the per-instance model
+// matrix (instanceModel in texture2.vert), after the VERTEX_LAYOUT ones.
+const GLuint INSTANCE_MODEL_LOCATION = 7;
+
+// Collects the frame's draws, drops those outside the view frustum, sorts
+// the rest by state and executes them through a GLStateCache. Consecutive
+// draws of the same mesh with the same program become one instanced draw,
+// with the model matrices in an instance buffer. Programs take the model
+// matrix from the model uniform, or from the instanceModel attribute while
+// their instanced uniform is set. Meshes and shaders must stay alive until
+// execute().
+class RenderQueue {
+public:
+  // Sets the camera of the frame: draws are culled against the frustum of
+  // projection * view and ordered by their distance along view. Without a
+  // camera nothing is culled.
+  void setCamera(const glm::mat4 &projection, const glm::mat4 &view) {
+    this->view = view;
+    frustum = Frustum::fromViewProjection(projection * view);
+    culling = true;
+  }
+
+  // Stores a model matrix for the draws that follow and returns its index.
+  uint32_t addTransform(const glm::mat4 &model) {
+    transforms.push_back(model);
+    return transforms.size() - 1;
+  }
+
+  void submit(Shader &shader, Mesh &mesh, uint32_t transform) {
+    // world space bounding sphere; the radius scales with the largest axis
+    const glm::mat4 &model = transforms[transform];
+    glm::vec3 center = model * glm::vec4(mesh.boundsCenter(), 1.0f);
+    float scale = std::max({glm::length(glm::vec3(model[0])),
+                            glm::length(glm::vec3(model[1])),
+                            glm::length(glm::vec3(model[2]))});
+    sphere_x.push_back(center.x);
+    sphere_y.push_back(center.y);
+    sphere_z.push_back(center.z);
+    sphere_radius.push_back(mesh.boundsRadius() * scale);
+    float depth = -(view * glm::vec4(center, 1.0f)).z;
+
+    uint64_t key = uint64_t(programSlot(shader)) << 56 |
+                   uint64_t(materialSlot(mesh)) << 40 |
+                   uint64_t(mesh.VAO & 0xffff) << 24 | depthKey(depth);
+    items.push_back({key, uint32_t(commands.size())});
+    commands.push_back({&shader, &mesh, transform});
+  }
+
+  size_t size() const { return commands.size(); }
+
+  // The CPU half of execute(): culls, sorts and splits the draws into
+  // batches without touching GL, so it also runs without a context. Call
+  // clear() afterwards if execute() does not follow.
+  void prepare(GLStateCache &state) {
+    cull(state);
+    radixSortRenderItems(items, scratch);
+    buildBatches();
+  }
+
+  // Draw calls the last prepare() produced.
+  size_t batchCount() const { return batches.size(); }
+
+  // Draws everything submitted since the last call in key order and empties
+  // the queue. Leaves VAO 0 and texture unit 0 bound, and instanced off in
+  // every program.
+  void execute(GLStateCache &state) {
+    prepare(state);
+    uploadInstances();
+    // ImGui and the uploads bound their own state since the last frame
+    state.invalidate();
+    Shader *current = nullptr;
+    bool instancing = false;
+    uint32_t transform = NO_TRANSFORM;
+    size_t first_instance = 0;
+    for (const Batch &batch : batches) {
+      const DrawCommand &cmd = commands[items[batch.begin].command];
+      GLsizei count = batch.end - batch.begin;
+      if (cmd.shader != current && instancing) {
+        current->setBool("instanced", false);
+        instancing = false;
+      }
+      if (state.useProgram(cmd.shader->ID))
+        transform = NO_TRANSFORM;
+      current = cmd.shader;
+      if ((count > 1) != instancing) {
+        instancing = count > 1;
+        cmd.shader->setBool("instanced", instancing);
+      }
+      if (instancing) {
+        state.bindVertexArray(cmd.mesh->VAO);
+        bindInstances(first_instance);
+        first_instance += count;
+      } else if (cmd.transform != transform) {
+        cmd.shader->setMat4("model", transforms[cmd.transform]);
+        transform = cmd.transform;
+      }
+      cmd.mesh->Draw(*cmd.shader, state, count);
+    }
+    if (instancing)
+      current->setBool("instanced", false);
+    state.bindVertexArray(0);
+    state.activeTexture(0);
+    clear();
+  }
+
+  // Deletes the instance buffer. GL thread only.
+  void release() {
+    if (instance_buffer != 0)
+      glDeleteBuffers(1, &instance_buffer);
+    instance_buffer = 0;
+    instance_capacity = 0;
+  }
+
+  void clear() {
+    commands.clear();
+    items.clear();
+    transforms.clear();
+    programs.clear();
+    materials.clear();
+    sphere_x.clear();
+    sphere_y.clear();
+    sphere_z.clear();
+    sphere_radius.clear();
+    batches.clear();
+    instance_data.clear();
+  }
+
+private:
+  static const uint32_t NO_TRANSFORM = ~0u;
+
+  struct DrawCommand {
+    Shader *shader;
+    Mesh *mesh;
+    uint32_t transform;
+  };
+
+  // sorted items [begin, end) drawn by one call
+  struct Batch {
+    size_t begin;
+    size_t end;
+  };
+
+  std::vector<DrawCommand> commands;
+  std::vector<RenderItem> items, scratch;
+  std::vector<glm::mat4> transforms;
+  // slot -> program, a frame rarely has more than a handful
+  std::vector<GLuint> programs;
+  // texture id set -> slot
+  std::unordered_map<uint64_t, uint32_t> materials;
+  glm::mat4 view = glm::mat4(1.0f);
+  Frustum frustum;
+  bool culling = false;
+  // world space bounding spheres by command, split by component for
+  // cullSpheres()
+  std::vector<float> sphere_x, sphere_y, sphere_z, sphere_radius;
+  std::vector<uint8_t> visible;
+  std::vector<Batch> batches;
+  // model matrices of the instanced batches in draw order
+  std::vector<glm::mat4> instance_data;
+  unsigned int instance_buffer = 0;
+  size_t instance_capacity = 0; // bytes, only grows
+
+  // Drops the items whose bounding sphere is outside the frustum and tells
+  // the meshes whether they are in view, so soft bodies only update their
+  // GPU vertices while they are drawn. Runs before the sort, while items
+  // are still in submission order.
+  void cull(GLStateCache &state) {
+    visible.assign(commands.size(), 1);
+    if (culling)
+      cullSpheres(frustum, sphere_x.data(), sphere_y.data(), sphere_z.data(),
+                  sphere_radius.data(), commands.size(), visible.data());
+    // a mesh submitted several times is in view if any copy is
+    for (const DrawCommand &cmd : commands)
+      cmd.mesh->in_view = false;
+    size_t kept = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+      if (!visible[items[i].command])
+        continue;
+      commands[items[i].command].mesh->in_view = true;
+      items[kept++] = items[i];
+    }
+    state.countCulled(items.size() - kept);
+    items.resize(kept);
+    for (const RenderItem &item : items)
+      commands[item.command].mesh->syncVertices();
+  }
+
+  // Splits the sorted items into batches and collects the matrices of the
+  // instanced ones.
+  void buildBatches() {
+    for (size_t begin = 0, end; begin < items.size(); begin = end) {
+      const DrawCommand &first = commands[items[begin].command];
+      for (end = begin + 1; end < items.size(); end++) {
+        const DrawCommand &next = commands[items[end].command];
+        if (next.shader != first.shader || next.mesh != first.mesh ||
+            first.mesh->VAO == 0)
+          break;
+      }
+      batches.push_back({begin, end});
+      if (end - begin > 1)
+        for (size_t i = begin; i < end; i++)
+          instance_data.push_back(
+              transforms[commands[items[i].command].transform]);
+    }
+  }
+
+  // The buffer is orphaned like the streamed vertices, and never shrinks, so
+  // the instance pointers left in a VAO stay in range.
+  void uploadInstances() {
+    if (instance_data.empty())
+      return;
+    size_t bytes = instance_data.size() * sizeof(glm::mat4);
+    if (instance_buffer == 0)
+      glGenBuffers(1, &instance_buffer);
+    if (bytes > instance_capacity)
+      instance_capacity = std::max(bytes, 2 * instance_capacity);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, instance_capacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instance_data.data());
+  }
+
+  // Points the instance attributes of the bound VAO at the matrices of the
+  // batch starting at first. GL 3.3 has no base instance, so the offset is
+  // set per batch.
+  void bindInstances(size_t first) {
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    for (GLuint column = 0; column < 4; column++) {
+      GLuint location = INSTANCE_MODEL_LOCATION + column;
+      glEnableVertexAttribArray(location);
+      glVertexAttribPointer(
+          location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+          (void *)(first * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+      glVertexAttribDivisor(location, 1);
+    }
+  }
+
+  uint32_t programSlot(const Shader &shader) {
+    auto it = std::find(programs.begin(), programs.end(), shader.ID);
+    if (it == programs.end())
+      it = programs.insert(programs.end(), shader.ID);
+    return std::min<uint32_t>(it - programs.begin(), 0xff);
+  }
+
+  // Meshes with the same textures share a slot. Texture ids are small
+  // integers, so the first four packed 16 bits each tell them apart.
+  uint32_t materialSlot(const Mesh &mesh) {
+    uint64_t id = 0;
+    for (size_t i = 0; i < std::min<size_t>(mesh.textures.size(), 4); i++)
+      id |= uint64_t(mesh.textures[i].id & 0xffff) << (16 * i);
+    auto [it, inserted] = materials.try_emplace(id, materials.size());
+    return std::min<uint32_t>(it->second, 0xffff);
+  }
+};
+
+#endif // !RENDERQUEUE_H
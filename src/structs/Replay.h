@@ -0,0 +1,214 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Per-frame interaction state that drives the soft body. Camera pose is
+// stored instead of raw mouse deltas so a replay does not depend on the
+// frame rate the session was recorded at.
+struct FrameInput {
+  float dt = 0.0f;
+  bool grab = false;
+  bool reset = false;
+  bool lift = false;
+
+  glm::vec3 cam_pos = {0, 0, 0};
+  glm::vec3 cam_front = {0, 0, -1};
+
+  float edge_compliance = 0.0f;
+  float volume_compliance = 0.0f;
+  int substeps = 1;
+
+  // particle picked by the grab ray this frame, -1 if none
+  int pick_particle = -1;
+  float pick_t = 0.0f;
+};
+
+// File layout: "SLRP", version, object name, then one record per frame.
+// A record is a flag byte and dt, followed by the camera, parameter and pick
+// blocks only when the flag byte says they changed/are present.
+enum ReplayFlags : uint8_t {
+  REPLAY_GRAB = 1 << 0,
+  REPLAY_RESET = 1 << 1,
+  REPLAY_LIFT = 1 << 2,
+  REPLAY_CAMERA = 1 << 3,
+  REPLAY_PARAMS = 1 << 4,
+  REPLAY_PICK = 1 << 5,
+};
+
+const char REPLAY_MAGIC[4] = {'S', 'L', 'R', 'P'};
+const uint32_t REPLAY_VERSION = 1;
+// object names are asset directory names, anything longer is not a replay
+const uint32_t REPLAY_MAX_NAME = 256;
+// range of the Substeps slider in main.cpp
+const int MAX_SUBSTEPS = 50;
+
+class InputRecorder {
+public:
+  bool open(const std::string &path, const std::string &object_name) {
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+      std::cerr << "ERROR::REPLAY::CANNOT_WRITE " << path << std::endl;
+      return false;
+    }
+    file.write(REPLAY_MAGIC, 4);
+    write(REPLAY_VERSION);
+    write(static_cast<uint32_t>(object_name.size()));
+    file.write(object_name.data(), object_name.size());
+    frames = 0;
+    return true;
+  }
+
+  bool is_open() const { return file.is_open(); }
+
+  void record(const FrameInput &in) {
+    if (!file.is_open())
+      return;
+    uint8_t flags = 0;
+    if (in.grab)
+      flags |= REPLAY_GRAB;
+    if (in.reset)
+      flags |= REPLAY_RESET;
+    if (in.lift)
+      flags |= REPLAY_LIFT;
+    if (frames == 0 || in.cam_pos != last.cam_pos ||
+        in.cam_front != last.cam_front)
+      flags |= REPLAY_CAMERA;
+    if (frames == 0 || in.edge_compliance != last.edge_compliance ||
+        in.volume_compliance != last.volume_compliance ||
+        in.substeps != last.substeps)
+      flags |= REPLAY_PARAMS;
+    if (in.pick_particle >= 0)
+      flags |= REPLAY_PICK;
+
+    write(flags);
+    write(in.dt);
+    if (flags & REPLAY_CAMERA) {
+      write(in.cam_pos);
+      write(in.cam_front);
+    }
+    if (flags & REPLAY_PARAMS) {
+      write(in.edge_compliance);
+      write(in.volume_compliance);
+      write(static_cast<int32_t>(in.substeps));
+    }
+    if (flags & REPLAY_PICK) {
+      write(static_cast<int32_t>(in.pick_particle));
+      write(in.pick_t);
+    }
+    last = in;
+    frames++;
+  }
+
+  void close() {
+    if (file.is_open())
+      file.close();
+  }
+
+  ~InputRecorder() { close(); }
+
+  uint32_t frames = 0;
+
+private:
+  std::ofstream file;
+  FrameInput last;
+
+  template <typename T> void write(const T &value) {
+    file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+};
+
+class InputReplayer {
+public:
+  std::string object_name;
+
+  bool open(const std::string &path) {
+    file.open(path, std::ios::binary);
+    if (!file) {
+      std::cerr << "ERROR::REPLAY::CANNOT_READ " << path << std::endl;
+      return false;
+    }
+    char magic[4];
+    uint32_t version = 0;
+    uint32_t name_size = 0;
+    file.read(magic, 4);
+    read(version);
+    read(name_size);
+    if (!file || std::string(magic, 4) != std::string(REPLAY_MAGIC, 4) ||
+        version != REPLAY_VERSION || name_size > REPLAY_MAX_NAME) {
+      std::cerr << "ERROR::REPLAY::BAD_HEADER " << path << std::endl;
+      file.close();
+      return false;
+    }
+    object_name.resize(name_size);
+    file.read(object_name.data(), name_size);
+    frames = 0;
+    return static_cast<bool>(file);
+  }
+
+  bool is_open() const { return file.is_open(); }
+
+  // Reads the next frame into `in`, carrying over unchanged camera and
+  // parameter blocks from the previous frame. Returns false at end of file
+  // or on a frame that cannot be replayed.
+  bool next(FrameInput &in) {
+    if (!file.is_open())
+      return false;
+    uint8_t flags;
+    if (!read(flags) || !read(current.dt))
+      return false;
+    current.grab = flags & REPLAY_GRAB;
+    current.reset = flags & REPLAY_RESET;
+    current.lift = flags & REPLAY_LIFT;
+    if (flags & REPLAY_CAMERA) {
+      read(current.cam_pos);
+      read(current.cam_front);
+    }
+    if (flags & REPLAY_PARAMS) {
+      int32_t substeps;
+      read(current.edge_compliance);
+      read(current.volume_compliance);
+      if (read(substeps) && (substeps < 1 || substeps > MAX_SUBSTEPS)) {
+        std::cerr << "ERROR::REPLAY::BAD_SUBSTEPS " << substeps
+                  << " in frame " << frames << std::endl;
+        return false;
+      }
+      current.substeps = substeps;
+    }
+    current.pick_particle = -1;
+    if (flags & REPLAY_PICK) {
+      int32_t particle;
+      read(particle);
+      read(current.pick_t);
+      current.pick_particle = particle;
+    }
+    if (!file)
+      return false;
+    in = current;
+    frames++;
+    return true;
+  }
+
+  void close() {
+    if (file.is_open())
+      file.close();
+  }
+
+  uint32_t frames = 0;
+
+private:
+  std::ifstream file;
+  FrameInput current;
+
+  template <typename T> bool read(T &value) {
+    file.read(reinterpret_cast<char *>(&value), sizeof(T));
+    return static_cast<bool>(file);
+  }
+};
+
+#endif // !REPLAY_H
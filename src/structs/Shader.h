@@ -3,17 +3,49 @@
 
 #include <glad/glad.h>
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
+#include <initializer_list>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Uniform blocks shared by every program, bound to the same binding points
+// at link time so one buffer per block serves all shaders (see
+// UniformBlocks.h for their layout).
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint LIGHTS_BLOCK_BINDING = 1;
+
+// Texture units: the ones below MATERIAL_TEXTURE_UNITS belong to mesh
+// materials, the rest hold the clustered light buffers (see
+// ClusteredLights.h). GL 3.3 guarantees 16 units per stage.
+const GLuint MATERIAL_TEXTURE_UNITS = 12;
+const GLuint LIGHT_DATA_UNIT = 12;
+const GLuint LIGHT_GRID_UNIT = 13;
+const GLuint LIGHT_INDEX_UNIT = 14;
+
+// Lets the location table be searched with a string_view or a literal
+// without building a std::string.
+struct UniformNameHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view name) const {
+    return std::hash<std::string_view>()(name);
+  }
+};
 
 class Shader {
 public:
   unsigned int ID;
 
+  // No program. Stands in where only the identity of a shader matters, e.g.
+  // RenderQueue::prepare() in the benchmarks, which run without GL.
+  Shader() : ID(0) {}
+
   Shader(const char *vertexPath, const char *fragmentPath) {
     std::string vertexCode;
     std::string fragmentCode;
@@ -66,33 +98,101 @@ public:
 
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+
+    reflectUniforms();
+    bindBlock("Camera", CAMERA_BLOCK_BINDING);
+    bindBlock("Lights", LIGHTS_BLOCK_BINDING);
+    bindSamplers({{"lightData", LIGHT_DATA_UNIT},
+                  {"lightGrid", LIGHT_GRID_UNIT},
+                  {"lightIndices", LIGHT_INDEX_UNIT}});
   };
 
   void use() { glUseProgram(ID); };
 
-  void setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+  // Location of an active uniform, or -1 (which GL ignores) if the program
+  // doesn't use it. Looked up in the table built at link time.
+  int uniformLocation(std::string_view name) const {
+    auto it = uniform_locations.find(name);
+    return it == uniform_locations.end() ? -1 : it->second;
+  }
+
+  void setBool(std::string_view name, bool value) const {
+    glUniform1i(uniformLocation(name), (int)value);
   };
-  void setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+  void setInt(std::string_view name, int value) const {
+    glUniform1i(uniformLocation(name), value);
   };
-  void setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+  void setFloat(std::string_view name, float value) const {
+    glUniform1f(uniformLocation(name), value);
   };
 
-  void setMat4(const std::string &name, glm::mat4 &value) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
+  void setMat4(std::string_view name, const glm::mat4 &value) const {
+    glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE,
                        glm::value_ptr(value));
   };
 
-  void setVec3(const std::string &name, float x, float y, float z) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+  void setVec3(std::string_view name, float x, float y, float z) const {
+    glUniform3f(uniformLocation(name), x, y, z);
   }
-  void setVec3(const std::string &name, glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+  void setVec3(std::string_view name, const glm::vec3 &value) const {
+    glUniform3fv(uniformLocation(name), 1, &value[0]);
   }
 
 private:
+  std::unordered_map<std::string, int, UniformNameHash, std::equal_to<>>
+      uniform_locations;
+
+  // Records the location of every active uniform outside a block. Arrays of
+  // basic types are reported once as "name[0]", so each element and the
+  // bare name are added as well.
+  void reflectUniforms() {
+    int count = 0, max_length = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::string name(std::max(max_length, 1), '\0');
+    for (int i = 0; i < count; i++) {
+      GLsizei length = 0;
+      GLint size = 0;
+      GLenum type;
+      glGetActiveUniform(ID, i, name.size(), &length, &size, &type,
+                         name.data());
+      std::string uniform(name.data(), length);
+      int location = glGetUniformLocation(ID, uniform.c_str());
+      if (location < 0)
+        continue; // lives in a uniform block
+      uniform_locations[uniform] = location;
+      if (uniform.size() < 3 || uniform.compare(uniform.size() - 3, 3,
+                                                "[0]") != 0)
+        continue;
+      std::string base = uniform.substr(0, uniform.size() - 3);
+      uniform_locations[base] = location;
+      for (int e = 1; e < size; e++) {
+        std::string element = base + "[" + std::to_string(e) + "]";
+        uniform_locations[element] =
+            glGetUniformLocation(ID, element.c_str());
+      }
+    }
+  }
+
+  void bindBlock(const char *block, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(ID, block);
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(ID, index, binding);
+  }
+
+  // Points samplers that are shared by every program at their fixed units.
+  // Uniforms can only be set on the current program, so it is swapped in
+  // and the previous one restored.
+  void bindSamplers(
+      std::initializer_list<std::pair<const char *, GLuint>> samplers) {
+    GLint previous = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(ID);
+    for (const auto &[name, unit] : samplers)
+      glUniform1i(uniformLocation(name), unit);
+    glUseProgram(previous);
+  }
+
   void checkCompileErrors(unsigned int shader, std::string type) {
     int success;
     char infoLog[1024];
@@ -0,0 +1,232 @@
+#ifndef SOFTBODYCACHE_H
+#define SOFTBODYCACHE_H
+
+#include <glm/glm.hpp>
+
+#include "AssetPack.h"
+#include "Mesh.h"
+#include "TetGenParser.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Binary cache of a fully built soft body: particles with masses, tets with
+// rest volumes, the unique edges with rest lengths and the vertex->particle
+// surface mapping. Loading it skips parsing, calcEdges() and the rest volume
+// computation. The cache is keyed on the size and modification time of each
+// source file, the particle mass and the weld tolerance, and is rebuilt when
+// any of them changes.
+//
+// Layout: SoftBodyCacheHeader, then each section 16 byte aligned:
+//   CachedParticle[particles] | Tetrahedron[tets] | Edge[edges] |
+//   int32 vertex_particle[vertices]
+
+const char SOFTBODY_CACHE_MAGIC[4] = {'S', 'L', 'S', 'B'};
+const uint32_t SOFTBODY_CACHE_VERSION = 3;
+const uint32_t SOFTBODY_CACHE_MAX_SOURCES = 4;
+
+struct CachedParticle {
+  glm::vec3 pos;
+  float mass;
+  float inv_mass;
+};
+
+struct SoftBodyCacheHeader {
+  char magic[4];
+  uint32_t version;
+  // guards against layout changes between builds
+  uint32_t particle_size, tet_size, edge_size;
+  uint32_t source_count;
+  uint64_t source_size[SOFTBODY_CACHE_MAX_SOURCES];
+  int64_t source_mtime[SOFTBODY_CACHE_MAX_SOURCES];
+  float mass;
+  float weld_tolerance;
+  uint32_t particles, tets, edges, vertices;
+};
+
+inline size_t cacheAlign(size_t offset) { return (offset + 15) & ~size_t(15); }
+
+// Fills the source file part of the header. Returns false if a source is
+// missing, in which case nothing should be cached.
+inline bool softBodyCacheKey(const std::vector<std::string> &sources,
+                             float mass, float weld_tolerance,
+                             SoftBodyCacheHeader &h) {
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, SOFTBODY_CACHE_MAGIC, 4);
+  h.version = SOFTBODY_CACHE_VERSION;
+  h.particle_size = sizeof(CachedParticle);
+  h.tet_size = sizeof(Tetrahedron);
+  h.edge_size = sizeof(Edge);
+  h.mass = mass;
+  h.weld_tolerance = weld_tolerance;
+  if (sources.size() > SOFTBODY_CACHE_MAX_SOURCES)
+    return false;
+  h.source_count = sources.size();
+  for (size_t i = 0; i < sources.size(); i++) {
+    // sources served from a pack are keyed on the pack, not the loose file
+    std::string_view packed;
+    if (AssetPack::get().view(sources[i], packed)) {
+      h.source_size[i] = packed.size();
+      h.source_mtime[i] = AssetPack::get().mtime();
+      continue;
+    }
+    std::error_code ec;
+    h.source_size[i] = std::filesystem::file_size(sources[i], ec);
+    if (ec)
+      return false;
+    h.source_mtime[i] = std::filesystem::last_write_time(sources[i], ec)
+                            .time_since_epoch()
+                            .count();
+    if (ec)
+      return false;
+  }
+  return true;
+}
+
+inline bool writeSoftBodyCache(const Mesh &mesh, const std::string &path,
+                               const std::vector<std::string> &sources,
+                               float mass) {
+  SoftBodyCacheHeader h;
+  if (!softBodyCacheKey(sources, mass, mesh.weld_tolerance, h))
+    return false;
+
+  h.particles = mesh.particles.size();
+  h.tets = mesh.tetrahedrons.size();
+  h.edges = mesh.edges.size();
+  h.vertices = mesh.vertex_particle.size();
+
+  std::vector<CachedParticle> cached(mesh.particles.size());
+  for (size_t i = 0; i < mesh.particles.size(); i++) {
+    const Particle &p = mesh.particles[i];
+    cached[i] = {p.pos, p.mass, p.inv_mass};
+  }
+
+  // write to a temporary name first so a crash never leaves a torn cache.
+  // With a pack the asset directory may not exist on disk.
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), ec);
+  std::string tmp_path = path + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+  size_t offset = 0;
+  auto section = [&](const void *data, size_t bytes) {
+    size_t aligned = cacheAlign(offset);
+    static const char zeros[16] = {};
+    file.write(zeros, aligned - offset);
+    file.write(static_cast<const char *>(data), bytes);
+    offset = aligned + bytes;
+  };
+  section(&h, sizeof(h));
+  section(cached.data(), cached.size() * sizeof(CachedParticle));
+  section(mesh.tetrahedrons.data(), h.tets * sizeof(Tetrahedron));
+  section(mesh.edges.data(), h.edges * sizeof(Edge));
+  section(mesh.vertex_particle.data(), h.vertices * sizeof(int32_t));
+  file.close();
+  if (!file)
+    return false;
+
+  std::filesystem::rename(tmp_path, path, ec);
+  return !ec;
+}
+
+// Loads a cache written by writeSoftBodyCache() into a mesh that has its
+// render vertices but no soft body yet. Returns false, leaving the mesh
+// untouched, if the cache is missing, stale, corrupt or from an incompatible
+// build.
+inline bool loadSoftBodyCache(Mesh &mesh, const std::string &path,
+                              const std::vector<std::string> &sources,
+                              float mass, float edge_compliance,
+                              float volume_compliance) {
+  SoftBodyCacheHeader expected;
+  if (!softBodyCacheKey(sources, mass, mesh.weld_tolerance, expected))
+    return false;
+  MappedFile file(path);
+  if (!file.good() || file.size() < sizeof(SoftBodyCacheHeader))
+    return false;
+
+  SoftBodyCacheHeader h;
+  std::memcpy(&h, file.data(), sizeof(h));
+  if (std::memcmp(h.magic, expected.magic, 4) != 0 ||
+      h.version != expected.version ||
+      h.particle_size != expected.particle_size ||
+      h.tet_size != expected.tet_size || h.edge_size != expected.edge_size ||
+      h.source_count != expected.source_count || h.mass != expected.mass ||
+      h.weld_tolerance != expected.weld_tolerance ||
+      std::memcmp(h.source_size, expected.source_size,
+                  sizeof(h.source_size)) != 0 ||
+      std::memcmp(h.source_mtime, expected.source_mtime,
+                  sizeof(h.source_mtime)) != 0)
+    return false;
+
+  size_t off_particles = cacheAlign(sizeof(h));
+  size_t off_tets =
+      cacheAlign(off_particles + size_t(h.particles) * sizeof(CachedParticle));
+  size_t off_edges =
+      cacheAlign(off_tets + size_t(h.tets) * sizeof(Tetrahedron));
+  size_t off_map = cacheAlign(off_edges + size_t(h.edges) * sizeof(Edge));
+  if (file.size() < off_map + size_t(h.vertices) * sizeof(int32_t))
+    return false;
+
+  const char *base = file.data();
+  const CachedParticle *cached =
+      reinterpret_cast<const CachedParticle *>(base + off_particles);
+  const int32_t *vertex_particle =
+      reinterpret_cast<const int32_t *>(base + off_map);
+  if (h.vertices != mesh.vertices.size())
+    return false; // render surface changed shape
+  for (uint32_t j = 0; j < h.vertices; j++) {
+    if (vertex_particle[j] < -1 || vertex_particle[j] >= int(h.particles))
+      return false;
+  }
+  // particle ids are stored as floats
+  auto valid_particle = [&](float id) {
+    return id >= 0.0f && id < float(h.particles) && id == std::floor(id);
+  };
+  const Tetrahedron *tets =
+      reinterpret_cast<const Tetrahedron *>(base + off_tets);
+  for (uint32_t t = 0; t < h.tets; t++) {
+    for (int k = 0; k < 4; k++)
+      if (!valid_particle(tets[t].particle_ids[k]))
+        return false;
+  }
+  const Edge *edges = reinterpret_cast<const Edge *>(base + off_edges);
+  for (uint32_t e = 0; e < h.edges; e++) {
+    if (!valid_particle(edges[e].particle_ids.x) ||
+        !valid_particle(edges[e].particle_ids.y))
+      return false;
+  }
+
+  mesh.is_soft = true;
+  mesh.edge_compliance = edge_compliance;
+  mesh.volume_compliance = volume_compliance;
+
+  // particle_reset is captured before the tets assign masses, so it keeps
+  // the uniform mass the body was loaded with
+  mesh.particles.clear();
+  mesh.particle_reset.clear();
+  mesh.particles.reserve(h.particles);
+  mesh.particle_reset.reserve(h.particles);
+  for (uint32_t i = 0; i < h.particles; i++) {
+    mesh.particle_reset.push_back(Particle(cached[i].pos, mass));
+    Particle p(cached[i].pos, cached[i].mass);
+    p.inv_mass = cached[i].inv_mass;
+    mesh.particles.push_back(p);
+  }
+
+  mesh.tetrahedrons.assign(tets, tets + h.tets);
+  mesh.edges.clear();
+  mesh.edges.reserve(h.edges);
+  mesh.edges.insert(mesh.edges.end(), edges, edges + h.edges);
+
+  mesh.vertex_particle.assign(vertex_particle, vertex_particle + h.vertices);
+  return true;
+}
+
+#endif // !SOFTBODYCACHE_H
@@ -0,0 +1,267 @@
+#ifndef TETGENPARSER_H
+#define TETGENPARSER_H
+
+#include <glm/glm.hpp>
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Returns the end of the line starting at p (the '\n' or end).
+inline const char *lineEnd(const char *p, const char *end) {
+  const char *nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+  return nl ? nl : end;
+}
+
+// Start of the line after the one ending at line_end.
+inline const char *nextLine(const char *line_end, const char *end) {
+  return line_end < end ? line_end + 1 : end;
+}
+
+// Parses up to max_values whitespace separated numbers from [p, end),
+// stopping at a '#' comment. Returns how many were read, or -1 if a token is
+// not a number.
+template <typename T>
+int parseNumbers(const char *p, const char *end, T *out, int max_values) {
+  int n = 0;
+  while (n < max_values) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+      p++;
+    if (p >= end || *p == '#')
+      break;
+    if (*p == '+') // from_chars does not accept a leading plus
+      p++;
+    auto [next, ec] = std::from_chars(p, end, out[n]);
+    if (ec != std::errc() ||
+        (next < end && *next != ' ' && *next != '\t' && *next != '\r' &&
+         *next != '#'))
+      return -1;
+    p = next;
+    n++;
+  }
+  return n;
+}
+
+inline void reportBadLine(const char *p, const char *line_end,
+                          const std::string &path) {
+  std::cerr << "Skipping malformed line in " << path << ": ["
+            << std::string(p, line_end) << "]\n";
+}
+
+// TetGen .node: the first line is the header ("<count> 3 <attrs> <markers>",
+// or blank in some of our assets), then "<id> <x> <y> <z> ...".
+inline bool loadTetGenNodes(const std::string &path,
+                            std::vector<glm::vec3> &out) {
+  MappedFile file(path);
+  if (!file.good())
+    return false;
+  const char *p = file.begin(), *end = file.end();
+  const char *le = lineEnd(p, end);
+  long header[4];
+  if (parseNumbers(p, le, header, 4) == 4 && header[1] == 3 && header[0] > 0)
+    out.reserve(out.size() + header[0]);
+  p = nextLine(le, end);
+
+  float v[4];
+  for (; p < end; p = nextLine(le, end)) {
+    le = lineEnd(p, end);
+    int n = parseNumbers(p, le, v, 4);
+    if (n == 0)
+      continue; // blank or comment
+    if (n < 4) {
+      reportBadLine(p, le, path);
+      continue;
+    }
+    out.push_back({v[1], v[2], v[3]});
+  }
+  return true;
+}
+
+// Parses "<id> <n0> <n1> <n2> <n3> ..." lines in [p, end) into 0-based tets.
+inline void parseElementLines(const char *p, const char *end,
+                              const std::string &path,
+                              std::vector<glm::ivec4> &out) {
+  const char *le;
+  long v[5];
+  for (; p < end; p = nextLine(le, end)) {
+    le = lineEnd(p, end);
+    int n = parseNumbers(p, le, v, 5);
+    if (n == 0)
+      continue;
+    if (n < 5) {
+      reportBadLine(p, le, path);
+      continue;
+    }
+    // Adjusting for 1-based indices
+    out.push_back(glm::ivec4(v[1] - 1, v[2] - 1, v[3] - 1, v[4] - 1));
+  }
+}
+
+// Skips blank lines and the optional "<count> 4 <attrs>" header. Returns the
+// start of the first element line and the declared count, or 0 without one.
+inline const char *skipElementHeader(const char *p, const char *end,
+                                     long &count) {
+  count = 0;
+  long v[5];
+  for (const char *le; p < end; p = nextLine(le, end)) {
+    le = lineEnd(p, end);
+    int n = parseNumbers(p, le, v, 5);
+    if (n == 0)
+      continue;
+    if (n == 3) {
+      count = std::max(0l, v[0]);
+      return nextLine(le, end);
+    }
+    return p;
+  }
+  return end;
+}
+
+// TetGen .ele: optional "<count> 4 <attrs>" header, then
+// "<id> <n0> <n1> <n2> <n3> ..." with 1-based node ids. Output is 0-based.
+inline bool loadTetGenElements(const std::string &path,
+                               std::vector<glm::ivec4> &out) {
+  MappedFile file(path);
+  if (!file.good())
+    return false;
+  long count;
+  const char *p = skipElementHeader(file.begin(), file.end(), count);
+  out.reserve(out.size() + count);
+  parseElementLines(p, file.end(), path, out);
+  return true;
+}
+
+// Same as loadTetGenElements(), but splits the file into newline aligned
+// chunks that are parsed on the pool and appended in file order. Small files
+// are parsed inline.
+inline bool loadTetGenElements(const std::string &path,
+                               std::vector<glm::ivec4> &out,
+                               ThreadPool &pool) {
+  const size_t MIN_CHUNK_BYTES = 1 << 18;
+  MappedFile file(path);
+  if (!file.good())
+    return false;
+  long count;
+  const char *begin = skipElementHeader(file.begin(), file.end(), count);
+  const char *end = file.end();
+  size_t bytes = end - begin;
+  size_t chunks = std::min<size_t>(pool.size() * 4,
+                                   bytes / MIN_CHUNK_BYTES + 1);
+  if (chunks <= 1) {
+    out.reserve(out.size() + count);
+    parseElementLines(begin, end, path, out);
+    return true;
+  }
+
+  // chunk c covers [starts[c], starts[c + 1]), each boundary moved forward
+  // to the start of a line
+  std::vector<const char *> starts(chunks + 1, end);
+  starts[0] = begin;
+  for (size_t c = 1; c < chunks; c++) {
+    const char *s = std::max(begin + bytes * c / chunks, starts[c - 1]);
+    starts[c] = s == begin ? s : nextLine(lineEnd(s - 1, end), end);
+  }
+  std::vector<std::vector<glm::ivec4>> parts(chunks);
+  pool.parallel_for(chunks, [&](size_t first, size_t last, unsigned) {
+    for (size_t c = first; c < last; c++) {
+      // rough guess from the average line length of our assets
+      parts[c].reserve((starts[c + 1] - starts[c]) / 24);
+      parseElementLines(starts[c], starts[c + 1], path, parts[c]);
+    }
+  });
+
+  size_t total = 0;
+  for (const auto &part : parts)
+    total += part.size();
+  out.reserve(out.size() + total);
+  for (const auto &part : parts)
+    out.insert(out.end(), part.begin(), part.end());
+  return true;
+}
+
+// TetGen .face: optional "<count> <markers>" header, then
+// "<id> <n0> <n1> <n2> [marker]" with 1-based node ids. Output is 0-based.
+inline bool loadTetGenFaces(const std::string &path,
+                            std::vector<glm::ivec3> &out) {
+  MappedFile file(path);
+  if (!file.good())
+    return false;
+  const char *p = file.begin(), *end = file.end();
+  const char *le;
+  long v[4];
+  bool first = true;
+  for (; p < end; p = nextLine(le, end)) {
+    le = lineEnd(p, end);
+    int n = parseNumbers(p, le, v, 4);
+    if (n == 0)
+      continue;
+    if (first && n == 2) {
+      if (v[0] > 0)
+        out.reserve(out.size() + v[0]);
+      first = false;
+      continue;
+    }
+    first = false;
+    if (n < 4) {
+      reportBadLine(p, le, path);
+      continue;
+    }
+    out.push_back(glm::ivec3(v[1] - 1, v[2] - 1, v[3] - 1));
+  }
+  return true;
+}
+
+// Legacy .nodes: one "<x> <z> <y>" per line, no header. y and z are swapped
+// on load.
+inline bool loadLegacyNodes(const std::string &path,
+                            std::vector<glm::vec3> &out) {
+  MappedFile file(path);
+  if (!file.good())
+    return false;
+  const char *p = file.begin(), *end = file.end();
+  const char *le;
+  float v[3];
+  for (; p < end; p = nextLine(le, end)) {
+    le = lineEnd(p, end);
+    int n = parseNumbers(p, le, v, 3);
+    if (n == 0)
+      continue;
+    if (n < 3) {
+      reportBadLine(p, le, path);
+      continue;
+    }
+    out.push_back({v[0], v[2], v[1]});
+  }
+  return true;
+}
+
+// Legacy .ele: one "<n0> <n1> <n2> <n3>" per line, 0-based, no header.
+inline bool loadLegacyElements(const std::string &path,
+                               std::vector<glm::ivec4> &out) {
+  MappedFile file(path);
+  if (!file.good())
+    return false;
+  const char *p = file.begin(), *end = file.end();
+  const char *le;
+  long v[4];
+  for (; p < end; p = nextLine(le, end)) {
+    le = lineEnd(p, end);
+    int n = parseNumbers(p, le, v, 4);
+    if (n == 0)
+      continue;
+    if (n < 4) {
+      reportBadLine(p, le, path);
+      continue;
+    }
+    out.push_back(glm::ivec4(v[0], v[1], v[2], v[3]));
+  }
+  return true;
+}
+
+#endif // !TETGENPARSER_H
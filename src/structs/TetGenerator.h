@@ -0,0 +1,196 @@
+#ifndef TETGENERATOR_H
+#define TETGENERATOR_H
+
+#include <glm/glm.hpp>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Procedural tetrahedral meshes for scaling tests. Shapes are built from a
+// voxel lattice where every kept cell is split into six tetrahedra around its
+// main diagonal, which keeps neighbouring cells conforming.
+
+enum TetShape { TET_CUBE, TET_SPHERE, TET_BEAM };
+
+struct TetMeshData {
+  std::vector<glm::vec3> nodes;
+  std::vector<glm::ivec4> tets;  // 0-based node ids, positive volume
+  std::vector<glm::ivec3> faces; // boundary triangles, wound outwards
+};
+
+inline bool parseTetShape(const std::string &name, TetShape &shape) {
+  if (name == "cube")
+    shape = TET_CUBE;
+  else if (name == "sphere")
+    shape = TET_SPHERE;
+  else if (name == "beam")
+    shape = TET_BEAM;
+  else
+    return false;
+  return true;
+}
+
+// Cell corners are numbered by bits: 1 = +x, 2 = +y, 4 = +z.
+inline glm::vec3 cornerOffset(int corner) {
+  return glm::vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+}
+
+// Cube with `resolution` cells per side spanning [-1, 1]^3, a voxelised
+// sphere of radius 1 at the same resolution, or a 4:1:1 beam.
+inline TetMeshData generateTetMesh(TetShape shape, int resolution) {
+  TetMeshData mesh;
+  if (resolution < 1)
+    return mesh;
+
+  int nx = resolution, ny = resolution, nz = resolution;
+  glm::vec3 origin = {-1, -1, -1};
+  glm::vec3 size = {2, 2, 2};
+  if (shape == TET_BEAM) {
+    nx = 4 * resolution;
+    origin = {-2, -0.5f, -0.5f};
+    size = {4, 1, 1};
+  }
+  glm::vec3 cell = size / glm::vec3(nx, ny, nz);
+
+  auto cell_index = [&](int x, int y, int z) {
+    return (size_t(z) * ny + y) * nx + x;
+  };
+  auto node_index = [&](int x, int y, int z) {
+    return (size_t(z) * (ny + 1) + y) * (nx + 1) + x;
+  };
+
+  std::vector<char> kept(size_t(nx) * ny * nz, 1);
+  if (shape == TET_SPHERE) {
+    for (int z = 0; z < nz; z++)
+      for (int y = 0; y < ny; y++)
+        for (int x = 0; x < nx; x++) {
+          glm::vec3 centre = origin + (glm::vec3(x, y, z) + 0.5f) * cell;
+          kept[cell_index(x, y, z)] = glm::dot(centre, centre) <= 1.0f;
+        }
+  }
+  auto is_kept = [&](int x, int y, int z) {
+    return x >= 0 && y >= 0 && z >= 0 && x < nx && y < ny && z < nz &&
+           kept[cell_index(x, y, z)];
+  };
+
+  // six tets per cell, one per axis permutation of the path 0 -> 7
+  const int axes[6][2] = {{0, 1}, {0, 2}, {1, 0}, {1, 2}, {2, 0}, {2, 1}};
+  int cell_tets[6][4];
+  for (int t = 0; t < 6; t++) {
+    int a = 1 << axes[t][0];
+    int b = a | (1 << axes[t][1]);
+    int *ids = cell_tets[t];
+    ids[0] = 0;
+    ids[1] = a;
+    ids[2] = b;
+    ids[3] = 7;
+    glm::vec3 p[4];
+    for (int i = 0; i < 4; i++)
+      p[i] = cornerOffset(ids[i]);
+    if (glm::dot(glm::cross(p[1] - p[0], p[2] - p[0]), p[3] - p[0]) < 0)
+      std::swap(ids[1], ids[2]);
+  }
+
+  // compact node ids so unused lattice nodes are dropped
+  std::vector<int> node_id(size_t(nx + 1) * (ny + 1) * (nz + 1), -1);
+  auto node_for = [&](int x, int y, int z, int corner) {
+    int cx = x + (corner & 1), cy = y + ((corner >> 1) & 1),
+        cz = z + ((corner >> 2) & 1);
+    int &id = node_id[node_index(cx, cy, cz)];
+    if (id < 0) {
+      id = mesh.nodes.size();
+      mesh.nodes.push_back(origin + glm::vec3(cx, cy, cz) * cell);
+    }
+    return id;
+  };
+
+  size_t kept_cells = 0;
+  for (char k : kept)
+    kept_cells += k;
+  mesh.tets.reserve(kept_cells * 6);
+
+  for (int z = 0; z < nz; z++)
+    for (int y = 0; y < ny; y++)
+      for (int x = 0; x < nx; x++) {
+        if (!kept[cell_index(x, y, z)])
+          continue;
+        int corners[8];
+        for (int c = 0; c < 8; c++)
+          corners[c] = node_for(x, y, z, c);
+        for (int t = 0; t < 6; t++) {
+          mesh.tets.push_back({corners[cell_tets[t][0]],
+                               corners[cell_tets[t][1]],
+                               corners[cell_tets[t][2]],
+                               corners[cell_tets[t][3]]});
+        }
+
+        // cell sides without a neighbour are on the boundary; each side is
+        // split along the diagonal from its lowest to its highest corner,
+        // matching the tet faces above
+        for (int axis = 0; axis < 3; axis++) {
+          for (int side = 0; side < 2; side++) {
+            glm::ivec3 n = {x, y, z};
+            n[axis] += side ? 1 : -1;
+            if (is_kept(n.x, n.y, n.z))
+              continue;
+            int u = 1 << ((axis + 1) % 3);
+            int v = 1 << ((axis + 2) % 3);
+            int q00 = side << axis;
+            int q10 = q00 | u, q01 = q00 | v, q11 = q00 | u | v;
+            // (u, v, axis) is right handed, so this winding faces +axis
+            glm::ivec3 tri0 = {q00, q10, q11};
+            glm::ivec3 tri1 = {q00, q11, q01};
+            if (!side) {
+              std::swap(tri0.y, tri0.z);
+              std::swap(tri1.y, tri1.z);
+            }
+            mesh.faces.push_back(
+                {corners[tri0.x], corners[tri0.y], corners[tri0.z]});
+            mesh.faces.push_back(
+                {corners[tri1.x], corners[tri1.y], corners[tri1.z]});
+          }
+        }
+      }
+  return mesh;
+}
+
+// Writes <base>.node, <base>.ele and <base>.face in TetGen's 1-based format,
+// so the files load through the regular asset path.
+inline bool writeTetGenFiles(const TetMeshData &mesh, const std::string &base) {
+  FILE *node = fopen((base + ".node").c_str(), "w");
+  FILE *ele = fopen((base + ".ele").c_str(), "w");
+  FILE *face = fopen((base + ".face").c_str(), "w");
+  bool ok = node && ele && face;
+  if (ok) {
+    fprintf(node, "%zu  3  0  0\n", mesh.nodes.size());
+    for (size_t i = 0; i < mesh.nodes.size(); i++) {
+      const glm::vec3 &p = mesh.nodes[i];
+      fprintf(node, "%zu  %.9g  %.9g  %.9g\n", i + 1, p.x, p.y, p.z);
+    }
+    fprintf(ele, "%zu  4  0\n", mesh.tets.size());
+    for (size_t i = 0; i < mesh.tets.size(); i++) {
+      const glm::ivec4 &t = mesh.tets[i];
+      fprintf(ele, "%zu  %d  %d  %d  %d\n", i + 1, t.x + 1, t.y + 1, t.z + 1,
+              t.w + 1);
+    }
+    fprintf(face, "%zu  0\n", mesh.faces.size());
+    for (size_t i = 0; i < mesh.faces.size(); i++) {
+      const glm::ivec3 &f = mesh.faces[i];
+      fprintf(face, "%zu  %d  %d  %d\n", i + 1, f.x + 1, f.y + 1, f.z + 1);
+    }
+    const char *footer = "# Generated by slimeEngine TetGenerator\n";
+    fputs(footer, node);
+    fputs(footer, ele);
+    fputs(footer, face);
+  } else {
+    std::cerr << "ERROR::TETGENERATOR::CANNOT_WRITE " << base << std::endl;
+  }
+  for (FILE *f : {node, ele, face})
+    if (f)
+      fclose(f);
+  return ok;
+}
+
+#endif // !TETGENERATOR_H
@@ -0,0 +1,488 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <glad/glad.h>
+
+#include <stb_image.h>
+
+#include "TetGenParser.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct MipLevel {
+  int32_t width, height;
+  uint64_t offset; // into TextureImage::pixels
+};
+
+// Decoded pixels with their full mip chain, base level first, waiting for
+// the GL upload. Empty if the decode failed.
+struct TextureImage {
+  std::string path; // canonical
+  uint64_t content_hash = 0;
+  bool flipped = false; // rows are bottom up
+  int width = 0, height = 0, channels = 0;
+  std::vector<MipLevel> levels;
+  // owns either a heap buffer or a mapped mip cache file
+  std::shared_ptr<const unsigned char> pixels;
+
+  size_t bytes() const {
+    if (levels.empty())
+      return 0;
+    const MipLevel &last = levels.back();
+    return last.offset + size_t(last.width) * last.height * channels;
+  }
+};
+
+// 64-bit FNV-1a over 8 byte words, fast enough to key multi-megabyte images.
+inline uint64_t contentHash(const char *data, size_t size) {
+  uint64_t h = 14695981039346656037ull ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    h = (h ^ word) * 1099511628211ull;
+  }
+  for (; i < size; i++)
+    h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+  return h ^ (h >> 32);
+}
+
+inline std::string canonicalTexturePath(const std::string &filename) {
+  std::error_code ec;
+  std::filesystem::path p = std::filesystem::weakly_canonical(filename, ec);
+  return ec ? filename : p.string();
+}
+
+// stb_image keeps the flip flag private, so it is mirrored here for the mip
+// cache key. Use this instead of calling stbi_set_flip_vertically_on_load.
+inline std::atomic<bool> texture_flip_vertically{false};
+
+inline void setTextureFlipVertically(bool flip) {
+  stbi_set_flip_vertically_on_load(flip);
+  texture_flip_vertically = flip;
+}
+
+// Box filters the base level of image down to 1x1.
+inline void buildMipChain(TextureImage &image, const unsigned char *base) {
+  int c = image.channels;
+  image.levels.clear();
+  size_t total = 0;
+  int w = image.width, h = image.height;
+  while (true) {
+    image.levels.push_back({w, h, total});
+    total += size_t(w) * h * c;
+    if (w == 1 && h == 1)
+      break;
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+  unsigned char *data = new unsigned char[total];
+  std::memcpy(data, base, size_t(image.width) * image.height * c);
+  for (size_t l = 1; l < image.levels.size(); l++) {
+    const MipLevel &src = image.levels[l - 1];
+    const MipLevel &dst = image.levels[l];
+    const unsigned char *s = data + src.offset;
+    unsigned char *d = data + dst.offset;
+    for (int y = 0; y < dst.height; y++) {
+      size_t y0 = std::min(2 * y, src.height - 1);
+      size_t y1 = std::min(2 * y + 1, src.height - 1);
+      const unsigned char *row0 = s + y0 * src.width * c;
+      const unsigned char *row1 = s + y1 * src.width * c;
+      unsigned char *out = d + size_t(y) * dst.width * c;
+      for (int x = 0; x < dst.width; x++) {
+        int x0 = std::min(2 * x, src.width - 1) * c;
+        int x1 = std::min(2 * x + 1, src.width - 1) * c;
+        for (int k = 0; k < c; k++) {
+          int sum = row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k];
+          out[x * c + k] = static_cast<unsigned char>((sum + 2) / 4);
+        }
+      }
+    }
+  }
+  image.pixels = std::shared_ptr<const unsigned char>(
+      data, std::default_delete<unsigned char[]>());
+}
+
+// Disk cache of decoded mip chains, one file per source image named after
+// its content hash, so later loads map the pixels instead of decoding them.
+// Disabled until a directory is set.
+//
+// Layout: MipCacheHeader, MipLevel[levels], pixels at a 16 byte boundary.
+class MipCache {
+public:
+  static MipCache &get() {
+    static MipCache instance;
+    return instance;
+  }
+
+  // An empty directory disables the cache.
+  void setDirectory(const std::string &dir) {
+    std::error_code ec;
+    if (!dir.empty())
+      std::filesystem::create_directories(dir, ec);
+    if (ec) {
+      std::cerr << "ERROR::MIP_CACHE::CANNOT_CREATE " << dir << std::endl;
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    directory = dir;
+  }
+
+  bool enabled() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !directory.empty();
+  }
+
+  // Fills image (whose path and content_hash are set) from the cache.
+  bool load(TextureImage &image, bool flipped) {
+    std::string path = fileFor(image.content_hash, flipped);
+    if (path.empty())
+      return false;
+    auto file = std::make_shared<MappedFile>(path);
+    if (!file->good() || file->size() < sizeof(MipCacheHeader))
+      return false;
+    MipCacheHeader h;
+    std::memcpy(&h, file->data(), sizeof(h));
+    if (std::memcmp(h.magic, "SLMP", 4) != 0 || h.version != VERSION ||
+        h.content_hash != image.content_hash || h.flipped != flipped ||
+        h.levels == 0 || h.levels > 32)
+      return false;
+    image.width = h.width;
+    image.height = h.height;
+    image.channels = h.channels;
+    image.levels.resize(h.levels);
+    std::memcpy(image.levels.data(), file->data() + sizeof(h),
+                h.levels * sizeof(MipLevel));
+    size_t data_offset = dataOffset(h.levels);
+    if (file->size() < data_offset + image.bytes())
+      return false;
+    // the pixels alias the mapping, which stays open while they are in use
+    image.pixels = std::shared_ptr<const unsigned char>(
+        file, reinterpret_cast<const unsigned char *>(file->data()) +
+                  data_offset);
+    return true;
+  }
+
+  void store(const TextureImage &image, bool flipped) {
+    std::string path = fileFor(image.content_hash, flipped);
+    if (path.empty() || !image.pixels)
+      return;
+    MipCacheHeader h = {};
+    std::memcpy(h.magic, "SLMP", 4);
+    h.version = VERSION;
+    h.content_hash = image.content_hash;
+    h.flipped = flipped;
+    h.width = image.width;
+    h.height = image.height;
+    h.channels = image.channels;
+    h.levels = image.levels.size();
+
+    // unique temporary name, two threads may store the same image
+    std::string tmp_path =
+        path + "." + std::to_string(std::hash<std::thread::id>()(
+                         std::this_thread::get_id())) +
+        ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file)
+      return;
+    file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    file.write(reinterpret_cast<const char *>(image.levels.data()),
+               image.levels.size() * sizeof(MipLevel));
+    static const char zeros[16] = {};
+    size_t written = sizeof(h) + image.levels.size() * sizeof(MipLevel);
+    file.write(zeros, dataOffset(h.levels) - written);
+    file.write(reinterpret_cast<const char *>(image.pixels.get()),
+               image.bytes());
+    file.close();
+    std::error_code ec;
+    if (file)
+      std::filesystem::rename(tmp_path, path, ec);
+    else
+      std::filesystem::remove(tmp_path, ec);
+  }
+
+private:
+  static const uint32_t VERSION = 1;
+
+  struct MipCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t content_hash;
+    uint32_t flipped;
+    int32_t width, height, channels;
+    uint32_t levels;
+  };
+
+  std::mutex mutex;
+  std::string directory;
+
+  static size_t dataOffset(uint32_t levels) {
+    return (sizeof(MipCacheHeader) + levels * sizeof(MipLevel) + 15) &
+           ~size_t(15);
+  }
+
+  std::string fileFor(uint64_t hash, bool flipped) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (directory.empty())
+      return "";
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx%s.mips",
+                  static_cast<unsigned long long>(hash), flipped ? "f" : "");
+    return directory + "/" + name;
+  }
+};
+
+// Reads, hashes and decodes an image, with its mip chain taken from the
+// MipCache when possible. Safe on any thread.
+inline TextureImage decodeTexture(const std::string &filename) {
+  TextureImage image;
+  image.path = canonicalTexturePath(filename);
+  MappedFile file(image.path);
+  if (!file.good() || file.size() == 0)
+    return image;
+  image.content_hash = contentHash(file.data(), file.size());
+  bool flipped = texture_flip_vertically;
+  image.flipped = flipped;
+  if (MipCache::get().load(image, flipped))
+    return image;
+
+  unsigned char *data = stbi_load_from_memory(
+      reinterpret_cast<const stbi_uc *>(file.data()), file.size(),
+      &image.width, &image.height, &image.channels, 0);
+  if (!data)
+    return image;
+  buildMipChain(image, data);
+  stbi_image_free(data);
+  MipCache::get().store(image, flipped);
+  return image;
+}
+
+inline ThreadPool &textureDecodePool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+// decodeTexture() on the texture decode pool.
+inline std::shared_future<TextureImage>
+decodeTextureAsync(const std::string &filename) {
+  return textureDecodePool()
+      .submit([filename] { return decodeTexture(filename); })
+      .share();
+}
+
+inline unsigned int uploadTexture(const TextureImage &image) {
+  unsigned int textureID;
+  glGenTextures(1, &textureID);
+
+  if (image.pixels) {
+    GLenum format;
+    if (image.channels == 1)
+      format = GL_RED;
+    else if (image.channels == 3)
+      format = GL_RGB;
+    else if (image.channels == 4)
+      format = GL_RGBA;
+
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    // rows of the smaller mips (and of odd width RGB images) are not padded
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t l = 0; l < image.levels.size(); l++) {
+      const MipLevel &level = image.levels[l];
+      glTexImage2D(GL_TEXTURE_2D, l, format, level.width, level.height, 0,
+                   format, GL_UNSIGNED_BYTE, image.pixels.get() + level.offset);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    image.levels.size() - 1);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  } else {
+    std::cout << "Texture failed to load at path: " << image.path
+              << std::endl;
+  }
+
+  return textureID;
+}
+
+// Process-wide cache of GL textures, looked up by canonical path and by a
+// hash of the file contents, so the same image is decoded and uploaded once
+// however many models or directories reference it. A flipped and an
+// unflipped load of one file are different textures, see
+// setTextureFlipVertically(). Every acquire must be
+// paired with a release. Unreferenced textures stay resident until the cache
+// goes over its memory budget, then the least recently used are deleted.
+//
+// Lookups may come from loader threads; uploads and evictions need the GL
+// thread.
+class TextureCache {
+public:
+  static TextureCache &get() {
+    static TextureCache instance;
+    return instance;
+  }
+
+  // Returns a referenced texture for filename, decoding and uploading it only
+  // on a miss, or 0 if it cannot be decoded. GL thread only.
+  unsigned int acquire(const std::string &filename) {
+    unsigned int id = acquireCached(filename);
+    if (id != 0)
+      return id;
+    return acquire(decodeTexture(filename));
+  }
+
+  // Returns a referenced texture if filename, or a file with the same
+  // contents, is already resident, or 0. Safe on any thread.
+  unsigned int acquireCached(const std::string &filename) {
+    std::string path = canonicalTexturePath(filename);
+    bool flipped = texture_flip_vertically;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = by_path[flipped].find(path);
+      if (it != by_path[flipped].end())
+        return addRef(it->second);
+    }
+    MappedFile file(path);
+    if (!file.good() || file.size() == 0)
+      return 0;
+    uint64_t hash = contentHash(file.data(), file.size());
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = by_hash[flipped].find(hash);
+    if (it == by_hash[flipped].end())
+      return 0;
+    by_path[flipped][path] = it->second;
+    return addRef(it->second);
+  }
+
+  // Uploads a decoded image, unless an identical one was uploaded since it
+  // was decoded. Returns a referenced texture, or 0 if the decode failed.
+  // Failures are not cached so a fixed file is retried. GL thread only.
+  unsigned int acquire(const TextureImage &image) {
+    if (!image.pixels) {
+      std::cout << "Texture failed to load at path: " << image.path
+                << std::endl;
+      return 0;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = by_hash[image.flipped].find(image.content_hash);
+    if (it != by_hash[image.flipped].end()) {
+      by_path[image.flipped][image.path] = it->second;
+      return addRef(it->second);
+    }
+    lock.unlock();
+    unsigned int id = uploadTexture(image);
+    lock.lock();
+    Entry &e = entries[id];
+    e.path = image.path;
+    e.content_hash = image.content_hash;
+    e.flipped = image.flipped;
+    e.bytes = image.bytes();
+    resident_bytes += e.bytes;
+    by_path[image.flipped][image.path] = id;
+    by_hash[image.flipped][image.content_hash] = id;
+    addRef(id);
+    evict();
+    return id;
+  }
+
+  // GL thread only, since it may delete textures.
+  void release(unsigned int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(id);
+    if (it == entries.end() || it->second.refs == 0)
+      return;
+    it->second.refs--;
+    evict();
+  }
+
+  void setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget_bytes = bytes;
+    evict();
+  }
+
+  size_t residentBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return resident_bytes;
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+  }
+
+private:
+  struct Entry {
+    std::string path;
+    uint64_t content_hash = 0;
+    bool flipped = false;
+    size_t bytes = 0;
+    int refs = 0;
+    uint64_t last_use = 0;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<unsigned int, Entry> entries; // by GL id
+  // indexed by TextureImage::flipped
+  std::unordered_map<std::string, unsigned int> by_path[2];
+  std::unordered_map<uint64_t, unsigned int> by_hash[2];
+  size_t resident_bytes = 0;
+  size_t budget_bytes = size_t(256) << 20;
+  uint64_t use_counter = 0;
+
+  unsigned int addRef(unsigned int id) {
+    Entry &e = entries[id];
+    e.refs++;
+    e.last_use = ++use_counter;
+    return id;
+  }
+
+  // Deletes unreferenced textures, least recently used first, until the
+  // cache fits its budget. Called with the mutex held.
+  void evict() {
+    while (resident_bytes > budget_bytes) {
+      auto victim = entries.end();
+      for (auto it = entries.begin(); it != entries.end(); it++) {
+        if (it->second.refs == 0 &&
+            (victim == entries.end() ||
+             it->second.last_use < victim->second.last_use))
+          victim = it;
+      }
+      if (victim == entries.end())
+        return; // everything left is in use
+      unsigned int id = victim->first;
+      resident_bytes -= victim->second.bytes;
+      std::unordered_map<std::string, unsigned int> &paths =
+          by_path[victim->second.flipped];
+      by_hash[victim->second.flipped].erase(victim->second.content_hash);
+      for (auto it = paths.begin(); it != paths.end();) {
+        if (it->second == id)
+          it = paths.erase(it);
+        else
+          it++;
+      }
+      entries.erase(victim);
+      glDeleteTextures(1, &id);
+    }
+  }
+};
+
+#endif // !TEXTURECACHE_H
@@ -0,0 +1,135 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads. A pool of size 1 or less runs work
+// inline on the calling thread so single threaded runs stay deterministic.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int thread_count =
+                          std::max(1u, std::thread::hardware_concurrency())) {
+    if (thread_count <= 1)
+      return;
+    for (unsigned int i = 0; i < thread_count; i++) {
+      workers.emplace_back([this] { worker_loop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      stopping = true;
+    }
+    queue_cv.notify_all();
+    for (std::thread &t : workers)
+      t.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned int size() const {
+    return workers.empty() ? 1 : static_cast<unsigned int>(workers.size());
+  }
+
+  template <typename F> auto submit(F &&f) -> std::future<decltype(f())> {
+    using R = decltype(f());
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    std::future<R> result = task->get_future();
+    if (workers.empty()) {
+      (*task)();
+      return result;
+    }
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      tasks.emplace([task] { (*task)(); });
+    }
+    queue_cv.notify_one();
+    return result;
+  }
+
+  // Splits [0, count) into at most size() contiguous chunks and blocks until
+  // every chunk has run. fn receives (begin, end, chunk index). While it
+  // waits, the calling thread runs queued tasks itself, so calling this from
+  // inside a pool task cannot deadlock on chunks queued behind it.
+  void parallel_for(size_t count,
+                    const std::function<void(size_t, size_t, unsigned int)> &fn,
+                    size_t min_chunk = 1) {
+    if (count == 0)
+      return;
+    size_t chunks =
+        std::min<size_t>(size(), (count + min_chunk - 1) / min_chunk);
+    if (chunks <= 1) {
+      fn(0, count, 0);
+      return;
+    }
+    size_t per_chunk = (count + chunks - 1) / chunks;
+    std::vector<std::future<void>> pending;
+    for (size_t c = 0; c < chunks; c++) {
+      size_t begin = c * per_chunk;
+      size_t end = std::min(count, begin + per_chunk);
+      if (begin >= end)
+        break;
+      pending.push_back(submit([&fn, begin, end, c] {
+        fn(begin, end, static_cast<unsigned int>(c));
+      }));
+    }
+    for (std::future<void> &f : pending) {
+      while (f.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        if (!run_pending_task()) {
+          // the chunk is running on another thread
+          f.wait();
+          break;
+        }
+      f.get();
+    }
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  bool stopping = false;
+
+  // Pops and runs one queued task. Returns false if the queue was empty.
+  bool run_pending_task() {
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      if (tasks.empty())
+        return false;
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+    task();
+    return true;
+  }
+
+  void worker_loop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (stopping && tasks.empty())
+          return;
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+};
+
+#endif // !THREADPOOL_H
@@ -0,0 +1,96 @@
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+#include <cstddef>
+
+// C++ mirrors of the std140 uniform blocks in the shaders. Every vec3 is
+// followed by a float (a member or padding) so the C++ layout matches the
+// 16 byte std140 alignment of vec3.
+
+// layout(std140) uniform Camera
+struct CameraBlock {
+  glm::mat4 projection;
+  glm::mat4 view;
+  glm::vec3 view_pos;
+  float pad0 = 0.0f;
+};
+
+struct DirLightBlock {
+  glm::vec3 direction;
+  float pad0 = 0.0f;
+  glm::vec3 ambient;
+  float pad1 = 0.0f;
+  glm::vec3 diffuse;
+  float pad2 = 0.0f;
+  glm::vec3 specular;
+  float pad3 = 0.0f;
+};
+
+struct SpotLightBlock {
+  glm::vec3 position;
+  float pad0 = 0.0f;
+  glm::vec3 direction;
+  float cutOff = 0.0f;
+  glm::vec3 ambient;
+  float pad1 = 0.0f;
+  glm::vec3 diffuse;
+  float pad2 = 0.0f;
+  glm::vec3 specular;
+  float pad3 = 0.0f;
+};
+
+// Cluster grid of the point lights, filled by ClusteredLights.
+struct ClusterBlock {
+  glm::uvec4 grid;  // tiles x, tiles y, depth slices, lights
+  glm::vec4 scale;  // tiles per pixel x and y, depth slice scale and bias
+};
+
+// layout(std140) uniform Lights. Point lights live in buffer textures, see
+// ClusteredLights.h.
+struct LightsBlock {
+  DirLightBlock dir_light;
+  SpotLightBlock spot_light;
+  ClusterBlock clusters;
+};
+
+static_assert(sizeof(CameraBlock) == 144, "Camera block layout");
+static_assert(sizeof(SpotLightBlock) == 80, "SpotLight std140 layout");
+static_assert(offsetof(LightsBlock, spot_light) == 64, "Lights block layout");
+static_assert(offsetof(LightsBlock, clusters) == 144, "Lights block layout");
+
+// A uniform buffer bound to a fixed binding point, so every program whose
+// block was bound there by Shader sees it. Create and update on the GL
+// thread.
+template <typename T> class UniformBuffer {
+public:
+  void create(GLuint binding) {
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_UNIFORM_BUFFER, id);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, id);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  void update(const T &data) {
+    glBindBuffer(GL_UNIFORM_BUFFER, id);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  void release() {
+    if (id != 0)
+      glDeleteBuffers(1, &id);
+    id = 0;
+  }
+
+private:
+  GLuint id = 0;
+};
+
+#endif // !UNIFORMBLOCKS_H